@@ -32,21 +32,238 @@
 
 GST_DEBUG_CATEGORY (gst_ducati_debug);
 
+/* the engine is shared by all elements, and kept open for a while after
+ * the last one is done with it, so that restarting a pipeline doesn't
+ * have to wait for it to be opened again.  The timeout (in ms) can be set
+ * with the GST_DUCATI_ENGINE_TIMEOUT environment variable:
+ */
+#define DEFAULT_ENGINE_TIMEOUT 5000
+
+static GStaticMutex engine_lock = G_STATIC_MUTEX_INIT;
+static Engine_Handle engine = NULL;
+static guint engine_refcnt = 0;
+static GstClockID engine_close_id = NULL;
+static GstClockTime engine_timeout = DEFAULT_ENGINE_TIMEOUT * GST_MSECOND;
+
+/* idle codec instances, kept to avoid the cost of creating a new one when
+ * an element needs a codec with the same name and params (which includes
+ * the max resolution).  Cached codecs don't keep the engine open: they are
+ * deleted when it is closed, or once idle for as long as the engine timeout.
+ * The max number cached can be set with the GST_DUCATI_CODEC_CACHE_SIZE
+ * environment variable, and the cache can be pre-filled when the first
+ * element goes to READY by setting GST_DUCATI_CODEC_CACHE to a list of
+ * element names and resolutions, for ex.
+ * "ducatih264dec:1920x1080,ducatimpeg2dec:720x576".  Those pre-warmed codecs
+ * do keep the engine open, until they are used or for the timeout (in ms)
+ * set with GST_DUCATI_CODEC_PREWARM_TIMEOUT
+ */
+#define DEFAULT_CODEC_CACHE_SIZE 4
+#define DEFAULT_CODEC_PREWARM_TIMEOUT 60000
+
+typedef struct
+{
+  gchar *name;
+  VIDDEC3_Params *params;
+  VIDDEC3_Handle codec;
+  GstClockTime expires;         /* or GST_CLOCK_TIME_NONE */
+  gboolean prewarmed;           /* holds a reference to the engine */
+} CachedCodec;
+
+static GStaticMutex codec_cache_lock = G_STATIC_MUTEX_INIT;
+static GList *codec_cache = NULL;       /* most recently used first */
+static guint codec_cache_size = DEFAULT_CODEC_CACHE_SIZE;
+static GstClockTime codec_prewarm_timeout =
+    DEFAULT_CODEC_PREWARM_TIMEOUT * GST_MSECOND;
+
+/* the accelerator only decodes one frame at a time, so rather than letting
+ * all elements race for it, process() calls are scheduled.  The policy for
+ * clients of the same priority is round-robin, unless GST_DUCATI_SCHED is
+ * set to "edf" for earliest-deadline-first:
+ */
+typedef enum
+{
+  SCHED_RR,
+  SCHED_EDF,
+} SchedPolicy;
+
+/* functions to call to free up memory when an allocation fails: */
+typedef struct
+{
+  GstDucatiShrinkFunc func;
+  gpointer data;
+} ShrinkFunc;
+
+static GStaticMutex shrink_lock = G_STATIC_MUTEX_INIT;
+static GList *shrink_funcs = NULL;
+
+static GMutex *sched_lock = NULL;
+static GCond *sched_cond = NULL;
+static GList *sched_waiting = NULL;     /* clients waiting, with sched_lock */
+static GstDucatiSchedClient *sched_running = NULL;
+static SchedPolicy sched_policy = SCHED_RR;
+
+static void
+codec_cache_prewarm (const gchar * entries)
+{
+  gchar **v = g_strsplit (entries, ",", 0);
+  gint i;
+
+  GST_DEBUG ("pre-warming codec cache: %s", entries);
+
+  for (i = 0; v[i]; i++) {
+    GstElementFactory *factory;
+    gchar name[64];
+    gint w, h;
+
+    if (sscanf (v[i], "%63[^:]:%dx%d", name, &w, &h) != 3) {
+      GST_WARNING ("invalid codec cache entry: %s", v[i]);
+      continue;
+    }
+
+    factory = gst_element_factory_find (name);
+    if (!factory) {
+      GST_WARNING ("no such element: %s", name);
+      continue;
+    }
+
+    GST_DEBUG ("pre-creating codec for %s at %dx%d", name, w, h);
+    gst_ducati_viddec_prewarm (gst_element_factory_get_element_type (factory),
+        w, h);
+    gst_object_unref (factory);
+  }
+
+  g_strfreev (v);
+}
+
+static void
+frame_cache_shrink (gpointer data)
+{
+  gst_ducati_frame_cache_flush ();
+}
+
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
+  const gchar *env;
+  gboolean ret;
+
   GST_DEBUG_CATEGORY_INIT (gst_ducati_debug, "ducati", 0, "ducati");
 
+  env = g_getenv ("GST_DUCATI_ENGINE_TIMEOUT");
+  if (env) {
+    engine_timeout = g_ascii_strtoull (env, NULL, 10) * GST_MSECOND;
+  }
+
+  env = g_getenv ("GST_DUCATI_FRAME_CACHE_SIZE");
+  if (env) {
+    gst_ducati_frame_cache_set_size (g_ascii_strtoull (env, NULL, 10));
+  }
+  gst_ducati_shrink_func_add (frame_cache_shrink, NULL);
+
+  env = g_getenv ("GST_DUCATI_CODEC_CACHE_SIZE");
+  if (env) {
+    codec_cache_size = g_ascii_strtoull (env, NULL, 10);
+  }
+
+  env = g_getenv ("GST_DUCATI_CODEC_PREWARM_TIMEOUT");
+  if (env) {
+    codec_prewarm_timeout = g_ascii_strtoull (env, NULL, 10) * GST_MSECOND;
+  }
+
+  env = g_getenv ("GST_DUCATI_SCHED");
+  if (env && !strcmp (env, "edf")) {
+    sched_policy = SCHED_EDF;
+  }
+
+  sched_lock = g_mutex_new ();
+  sched_cond = g_cond_new ();
+
   /* TODO .. find some way to reasonably detect if the corresponding
    * codecs are actually available..
    */
-  return gst_element_register (plugin, "ducatih264dec", GST_RANK_PRIMARY, GST_TYPE_DUCATIH264DEC) &&
+  ret = gst_element_register (plugin, "ducatih264dec", GST_RANK_PRIMARY, GST_TYPE_DUCATIH264DEC) &&
       gst_element_register (plugin, "ducatimpeg4dec", GST_RANK_PRIMARY, GST_TYPE_DUCATIMPEG4DEC) &&
       gst_element_register (plugin, "ducatimpeg2dec", GST_RANK_PRIMARY, GST_TYPE_DUCATIMPEG2DEC) &&
       gst_element_register (plugin, "ducativc1dec", GST_RANK_PRIMARY, GST_TYPE_DUCATIVC1DEC) &&
       gst_element_register (plugin, "ducativp6dec", GST_RANK_PRIMARY, GST_TYPE_DUCATIVP6DEC) &&
       gst_element_register (plugin, "ducativp7dec", GST_RANK_PRIMARY, GST_TYPE_DUCATIVP7DEC) &&
       gst_element_register (plugin, "ducatirvdec", GST_RANK_PRIMARY, GST_TYPE_DUCATIRVDEC);
+
+  return ret;
+}
+
+/** fill the codec cache as requested by GST_DUCATI_CODEC_CACHE, the first
+ * time this is called.  Not done when the plugin is loaded, since that also
+ * happens when just scanning the registry
+ */
+void
+gst_ducati_codec_cache_prewarm (void)
+{
+  static volatile gsize done = 0;
+
+  if (g_once_init_enter (&done)) {
+    const gchar *env = g_getenv ("GST_DUCATI_CODEC_CACHE");
+    if (env && codec_cache_size) {
+      codec_cache_prewarm (env);
+    }
+    g_once_init_leave (&done, 1);
+  }
+}
+
+void
+gst_ducati_shrink_func_add (GstDucatiShrinkFunc func, gpointer data)
+{
+  ShrinkFunc *f = g_new (ShrinkFunc, 1);
+
+  f->func = func;
+  f->data = data;
+
+  g_static_mutex_lock (&shrink_lock);
+  shrink_funcs = g_list_prepend (shrink_funcs, f);
+  g_static_mutex_unlock (&shrink_lock);
+}
+
+void
+gst_ducati_shrink_func_remove (GstDucatiShrinkFunc func, gpointer data)
+{
+  GList *l;
+
+  g_static_mutex_lock (&shrink_lock);
+  for (l = shrink_funcs; l; l = l->next) {
+    ShrinkFunc *f = l->data;
+    if ((f->func == func) && (f->data == data)) {
+      shrink_funcs = g_list_delete_link (shrink_funcs, l);
+      g_free (f);
+      break;
+    }
+  }
+  g_static_mutex_unlock (&shrink_lock);
+}
+
+/** MemMgr_Alloc(), but if it fails, ask everyone to free what they can
+ * and try again
+ */
+static void *
+mem_alloc (MemAllocBlock * blocks, int num_blocks)
+{
+  void *ptr = MemMgr_Alloc (blocks, num_blocks);
+
+  if (G_UNLIKELY (!ptr)) {
+    GList *l;
+
+    GST_WARNING ("allocation failed, shrinking");
+
+    g_static_mutex_lock (&shrink_lock);
+    for (l = shrink_funcs; l; l = l->next) {
+      ShrinkFunc *f = l->data;
+      f->func (f->data);
+    }
+    g_static_mutex_unlock (&shrink_lock);
+
+    ptr = MemMgr_Alloc (blocks, num_blocks);
+  }
+
+  return ptr;
 }
 
 void *
@@ -56,7 +273,7 @@ gst_ducati_alloc_1d (gint sz)
     .pixelFormat = PIXEL_FMT_PAGE,
     .dim.len = sz,
   };
-  return MemMgr_Alloc (&block, 1);
+  return mem_alloc (&block, 1);
 }
 
 void *
@@ -81,7 +298,313 @@ gst_ducati_alloc_2d (gint width, gint height, guint * sz)
   if (sz) {
     *sz = (4096 * ALIGN2 (height, 1) * 3) / 2;
   }
-  return MemMgr_Alloc (block, 2);
+  return mem_alloc (block, 2);
+}
+
+/** with engine_lock */
+static void
+engine_cancel_close (void)
+{
+  if (engine_close_id) {
+    gst_clock_id_unschedule (engine_close_id);
+    gst_clock_id_unref (engine_close_id);
+    engine_close_id = NULL;
+  }
+}
+
+static void
+codec_cache_free (CachedCodec * c)
+{
+  VIDDEC3_delete (c->codec);
+  if (c->prewarmed) {
+    gst_ducati_engine_put (engine);
+  }
+  g_free (c->name);
+  g_free (c->params);
+  g_free (c);
+}
+
+/** delete the cached codecs that expired (or all of them), or just the
+ * pre-warmed ones.  Unless only deleting pre-warmed codecs, which hold
+ * their own reference to the engine, the caller must keep it open
+ */
+static void
+codec_cache_expire (gboolean all, gboolean prewarmed_only)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GList *l, *next, *expired = NULL;
+
+  g_static_mutex_lock (&codec_cache_lock);
+  for (l = codec_cache; l; l = next) {
+    CachedCodec *c = l->data;
+
+    next = l->next;
+    if ((prewarmed_only && !c->prewarmed) ||
+        (!all && (!GST_CLOCK_TIME_IS_VALID (c->expires) || now < c->expires))) {
+      continue;
+    }
+    codec_cache = g_list_remove_link (codec_cache, l);
+    expired = g_list_concat (l, expired);
+  }
+  g_static_mutex_unlock (&codec_cache_lock);
+
+  for (l = expired; l; l = l->next) {
+    CachedCodec *c = l->data;
+    GST_DEBUG ("deleting cached codec: %s", c->name);
+    codec_cache_free (c);
+  }
+  g_list_free (expired);
+}
+
+static gboolean
+codec_cache_prewarm_cb (GstClock * clock, GstClockTime time, GstClockID id,
+    gpointer user_data)
+{
+  codec_cache_expire (FALSE, TRUE);
+  return TRUE;
+}
+
+/** with engine_lock.  The codecs created on the engine must be deleted
+ * first, so that includes the cached ones (none of which are pre-warmed,
+ * since those hold a reference)
+ */
+static void
+engine_close (void)
+{
+  GST_DEBUG ("closing engine");
+  codec_cache_expire (TRUE, FALSE);
+  Engine_close (engine);
+  engine = NULL;
+}
+
+static gboolean
+engine_close_cb (GstClock * clock, GstClockTime time, GstClockID id,
+    gpointer user_data)
+{
+  g_static_mutex_lock (&engine_lock);
+  /* unless it was re-opened in the mean time: */
+  if ((id == engine_close_id) && !engine_refcnt) {
+    engine_close ();
+    engine_cancel_close ();
+  }
+  g_static_mutex_unlock (&engine_lock);
+
+  return TRUE;
+}
+
+/** get a reference to the shared engine, opening it if needed */
+Engine_Handle
+gst_ducati_engine_get (void)
+{
+  Engine_Handle ret;
+
+  g_static_mutex_lock (&engine_lock);
+
+  engine_cancel_close ();
+
+  if (!engine) {
+    GST_DEBUG ("opening engine");
+    engine = Engine_open ((String)"ivahd_vidsvr", NULL, NULL);
+  }
+
+  if (engine) {
+    engine_refcnt++;
+  }
+
+  ret = engine;
+
+  g_static_mutex_unlock (&engine_lock);
+
+  return ret;
+}
+
+/** release a reference to the shared engine, which is closed once it has
+ * been unused for the timeout
+ */
+void
+gst_ducati_engine_put (Engine_Handle e)
+{
+  g_static_mutex_lock (&engine_lock);
+
+  if (G_UNLIKELY ((e != engine) || !engine_refcnt)) {
+    GST_ERROR ("not the shared engine: %p", e);
+  } else if (--engine_refcnt == 0) {
+    if (engine_timeout) {
+      GstClock *clock = gst_system_clock_obtain ();
+      engine_close_id = gst_clock_new_single_shot_id (clock,
+          gst_clock_get_time (clock) + engine_timeout);
+      gst_clock_id_wait_async (engine_close_id, engine_close_cb, NULL);
+      gst_object_unref (clock);
+    } else {
+      engine_close ();
+    }
+  }
+
+  g_static_mutex_unlock (&engine_lock);
+}
+
+/** take an idle codec created with the same name and params from the
+ * cache, or NULL if there is none
+ */
+VIDDEC3_Handle
+gst_ducati_codec_cache_get (const gchar * name, VIDDEC3_Params * params)
+{
+  CachedCodec *c = NULL;
+  VIDDEC3_Handle codec = NULL;
+  GList *l;
+
+  codec_cache_expire (FALSE, FALSE);
+
+  g_static_mutex_lock (&codec_cache_lock);
+  for (l = codec_cache; l; l = l->next) {
+    CachedCodec *cc = l->data;
+    if (!strcmp (cc->name, name) && (cc->params->size == params->size) &&
+        !memcmp (cc->params, params, params->size)) {
+      codec_cache = g_list_delete_link (codec_cache, l);
+      c = cc;
+      break;
+    }
+  }
+  g_static_mutex_unlock (&codec_cache_lock);
+
+  if (c) {
+    codec = c->codec;
+    /* caller has its own reference to the engine: */
+    if (c->prewarmed) {
+      gst_ducati_engine_put (engine);
+    }
+    g_free (c->name);
+    g_free (c->params);
+    g_free (c);
+  }
+
+  return codec;
+}
+
+/** put an idle codec (which should already have been reset) in the cache,
+ * returning FALSE if the caller should delete it instead.  The caller must
+ * still hold its reference to the engine.  A 'prewarmed' codec keeps the
+ * engine open itself, until it is used or for the pre-warm timeout
+ */
+gboolean
+gst_ducati_codec_cache_put (const gchar * name, VIDDEC3_Params * params,
+    VIDDEC3_Handle codec, gboolean prewarmed)
+{
+  CachedCodec *c, *evict = NULL;
+  GstClockTime timeout = prewarmed ? codec_prewarm_timeout : engine_timeout;
+
+  if (!codec_cache_size) {
+    return FALSE;
+  }
+
+  c = g_new (CachedCodec, 1);
+  c->name = g_strdup (name);
+  c->params = g_memdup (params, params->size);
+  c->codec = codec;
+  c->prewarmed = prewarmed;
+  c->expires = timeout ? gst_util_get_timestamp () + timeout :
+      GST_CLOCK_TIME_NONE;
+
+  if (prewarmed) {
+    gst_ducati_engine_get ();
+
+    /* expire it even if nothing uses the cache in the mean time: */
+    if (timeout) {
+      GstClock *clock = gst_system_clock_obtain ();
+      GstClockID id = gst_clock_new_single_shot_id (clock,
+          gst_clock_get_time (clock) + timeout);
+      gst_clock_id_wait_async (id, codec_cache_prewarm_cb, NULL);
+      gst_clock_id_unref (id);
+      gst_object_unref (clock);
+    }
+  }
+
+  codec_cache_expire (FALSE, FALSE);
+
+  g_static_mutex_lock (&codec_cache_lock);
+  codec_cache = g_list_prepend (codec_cache, c);
+  if (g_list_length (codec_cache) > codec_cache_size) {
+    GList *l = g_list_last (codec_cache);
+    evict = l->data;
+    codec_cache = g_list_delete_link (codec_cache, l);
+  }
+  g_static_mutex_unlock (&codec_cache_lock);
+
+  if (evict) {
+    GST_DEBUG ("evicting cached codec: %s", evict->name);
+    codec_cache_free (evict);
+  }
+
+  return TRUE;
+}
+
+/** should 'a' run before 'b'? */
+static gboolean
+sched_before (GstDucatiSchedClient * a, GstDucatiSchedClient * b)
+{
+  if (a->priority != b->priority) {
+    return a->priority > b->priority;
+  }
+
+  if ((sched_policy == SCHED_EDF) && (a->due != b->due)) {
+    /* note: GST_CLOCK_TIME_NONE (no deadline) sorts last */
+    return a->due < b->due;
+  }
+
+  /* whoever has waited longest since it last ran: */
+  return a->last_run < b->last_run;
+}
+
+/** wait until it is the client's turn to use the accelerator */
+void
+gst_ducati_sched_begin (GstDucatiSchedClient * client)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+
+  if (GST_CLOCK_TIME_IS_VALID (client->deadline) && client->deadline) {
+    client->due = now + client->deadline;
+  } else {
+    client->due = GST_CLOCK_TIME_NONE;
+  }
+
+  g_mutex_lock (sched_lock);
+  if (sched_running) {
+    sched_waiting = g_list_append (sched_waiting, client);
+    while (sched_running != client) {
+      g_cond_wait (sched_cond, sched_lock);
+    }
+  } else {
+    sched_running = client;
+  }
+  g_mutex_unlock (sched_lock);
+
+  client->start = gst_util_get_timestamp ();
+  client->wait_time += client->start - now;
+}
+
+/** done using the accelerator, hand it over to the next client */
+void
+gst_ducati_sched_end (GstDucatiSchedClient * client)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GList *l;
+
+  client->busy_time += now - client->start;
+  client->last_run = now;
+  client->n_runs++;
+
+  g_mutex_lock (sched_lock);
+  sched_running = NULL;
+  for (l = sched_waiting; l; l = l->next) {
+    if (!sched_running || sched_before (l->data, sched_running)) {
+      sched_running = l->data;
+    }
+  }
+  if (sched_running) {
+    sched_waiting = g_list_remove (sched_waiting, sched_running);
+    g_cond_broadcast (sched_cond);
+  }
+  g_mutex_unlock (sched_lock);
 }
 
 XDAS_Int16
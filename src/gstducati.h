@@ -41,10 +41,50 @@ GST_DEBUG_CATEGORY_EXTERN (gst_ducati_debug);
 /* align x to next highest multiple of 2^n */
 #define ALIGN2(x,n)   (((x) + ((1 << (n)) - 1)) & ~((1 << (n)) - 1))
 
+typedef struct _GstDucatiSchedClient GstDucatiSchedClient;
+
+/* each element using the accelerator registers as a client of the plugin
+ * wide scheduler, which decides which element gets to call process() next
+ */
+struct _GstDucatiSchedClient
+{
+  gint priority;             /* higher priority clients always go first */
+  GstClockTime deadline;     /* max time to wait, relative to request */
+
+  /* accounting: */
+  GstClockTime busy_time;    /* total time using the accelerator */
+  GstClockTime wait_time;    /* total time waiting for the accelerator */
+  guint n_runs;
+
+  /* private: */
+  GstClockTime due, start, last_run;
+};
+
 void * gst_ducati_alloc_1d (gint sz);
+
+void gst_ducati_sched_begin (GstDucatiSchedClient * client);
+void gst_ducati_sched_end (GstDucatiSchedClient * client);
+
 void * gst_ducati_alloc_2d (gint width, gint height, guint * sz);
 XDAS_Int16 gst_ducati_get_mem_type (SSPtr paddr);
 
+/* called when TILER memory runs out, to free whatever memory can be freed
+ * (for ex. idle buffers in bufferpools) before trying again:
+ */
+typedef void (*GstDucatiShrinkFunc) (gpointer data);
+
+void gst_ducati_shrink_func_add (GstDucatiShrinkFunc func, gpointer data);
+void gst_ducati_shrink_func_remove (GstDucatiShrinkFunc func, gpointer data);
+
+Engine_Handle gst_ducati_engine_get (void);
+void gst_ducati_engine_put (Engine_Handle engine);
+
+VIDDEC3_Handle gst_ducati_codec_cache_get (const gchar * name,
+    VIDDEC3_Params * params);
+gboolean gst_ducati_codec_cache_put (const gchar * name,
+    VIDDEC3_Params * params, VIDDEC3_Handle codec, gboolean prewarmed);
+void gst_ducati_codec_cache_prewarm (void);
+
 G_END_DECLS
 
 #endif /* __GST_DUCATI_H__ */
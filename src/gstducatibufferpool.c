@@ -17,8 +17,376 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
 #include "gstducatibufferpool.h"
 
+/*
+ * freelist: the buffers returned from downstream are pushed on the sink's
+ * streaming thread, and popped again on the decoder's, so it is lock-free
+ * where the target can compare-and-swap a pointer and a tag at once
+ */
+
+#ifndef HAVE_DWCAS
+
+/* the freelist is only held for a push or pop, so one lock for all pools
+ * is enough:
+ */
+static GStaticMutex freelist_lock = G_STATIC_MUTEX_INIT;
+
+static void
+freelist_push (GstDucatiBufferPool * pool, GstDucatiBuffer * buf)
+{
+  g_static_mutex_lock (&freelist_lock);
+  buf->next = pool->freelist;
+  pool->freelist = buf;
+  g_static_mutex_unlock (&freelist_lock);
+
+  g_atomic_int_inc (&pool->n_free);
+}
+
+static GstDucatiBuffer *
+freelist_pop (GstDucatiBufferPool * pool)
+{
+  GstDucatiBuffer *buf;
+
+  g_static_mutex_lock (&freelist_lock);
+  buf = pool->freelist;
+  if (buf) {
+    pool->freelist = buf->next;
+  }
+  g_static_mutex_unlock (&freelist_lock);
+
+  if (!buf) {
+    return NULL;
+  }
+
+  g_atomic_int_add (&pool->n_free, -1);
+  buf->next = NULL;
+
+  return buf;
+}
+
+#else
+
+#define FREELIST_TAG_SHIFT (GLIB_SIZEOF_VOID_P * 8)
+
+static inline GstDucatiBuffer *
+freelist_buffer (GstDucatiFreelist head)
+{
+  return (GstDucatiBuffer *) (gsize) head;
+}
+
+static inline GstDucatiFreelist
+freelist_head (GstDucatiBuffer * buf, GstDucatiFreelist old)
+{
+  gsize tag = (gsize) (old >> FREELIST_TAG_SHIFT) + 1;
+  return ((GstDucatiFreelist) tag << FREELIST_TAG_SHIFT) | (gsize) buf;
+}
+
+static void
+freelist_push (GstDucatiBufferPool * pool, GstDucatiBuffer * buf)
+{
+  GstDucatiFreelist old;
+
+  do {
+    old = pool->freelist;
+    buf->next = freelist_buffer (old);
+  } while (!__sync_bool_compare_and_swap (&pool->freelist, old,
+          freelist_head (buf, old)));
+
+  g_atomic_int_inc (&pool->n_free);
+}
+
+static GstDucatiBuffer *
+freelist_pop (GstDucatiBufferPool * pool)
+{
+  GstDucatiFreelist old;
+  GstDucatiBuffer *buf;
+
+  /* pops are serialized, since _trim() (which frees what it pops) may be
+   * called from any thread when memory runs out, and reading 'next' of a
+   * buffer freed in the mean time is not safe.  Pushes are still lock-free,
+   * and a push racing with a pop just makes the compare-and-swap fail.
+   * Same if reading the head was not atomic, since the pointer half of it
+   * is:
+   */
+  g_static_rec_mutex_lock (&pool->pop_lock);
+  do {
+    old = pool->freelist;
+    buf = freelist_buffer (old);
+    if (!buf) {
+      g_static_rec_mutex_unlock (&pool->pop_lock);
+      return NULL;
+    }
+  } while (!__sync_bool_compare_and_swap (&pool->freelist, old,
+          freelist_head (buf->next, old)));
+  g_static_rec_mutex_unlock (&pool->pop_lock);
+
+  g_atomic_int_add (&pool->n_free, -1);
+  buf->next = NULL;
+
+  return buf;
+}
+
+#endif /* HAVE_DWCAS */
+
+/*
+ * frame cache: memory of buffers freed by a pool that was destroyed is kept
+ * for a while, so that another pool (for ex. of another decoder, or the next
+ * one created after a channel is restarted) that needs buffers of the same
+ * geometry can use it rather than allocating.  Each element (all the pools
+ * sharing a cache account) can only keep up to cache_quota buffers in the
+ * cache, so no one element can fill it up.  The max number of buffers
+ * cached can be set with the GST_DUCATI_FRAME_CACHE_SIZE environment variable
+ */
+
+#define DEFAULT_FRAME_CACHE_SIZE 16
+#define FRAME_CACHE_TIMEOUT (10 * GST_SECOND)
+
+struct _GstDucatiCacheAccount
+{
+  gint refcount;             /* with frame_cache_lock */
+  guint n_cached;            /* with frame_cache_lock */
+};
+
+typedef struct
+{
+  guint8 *data;              /* including any headroom */
+  gint width, height;        /* 2D buffers */
+  guint size;                /* 1D buffers, including headroom, or 0 */
+  guint frame_size;
+  GstClockTime time;         /* when it was put in the cache */
+  GstDucatiCacheAccount *account;
+} CachedFrame;
+
+static GStaticMutex frame_cache_lock = G_STATIC_MUTEX_INIT;
+static GList *frame_cache = NULL;       /* most recently freed first */
+static guint frame_cache_len = 0;
+static guint frame_cache_size = DEFAULT_FRAME_CACHE_SIZE;
+static GstClockID frame_cache_timer = NULL;     /* with frame_cache_lock */
+
+/** new account of buffers in the frame cache, to share between pools */
+GstDucatiCacheAccount *
+gst_ducati_cache_account_new (void)
+{
+  GstDucatiCacheAccount *account = g_new0 (GstDucatiCacheAccount, 1);
+  account->refcount = 1;
+  return account;
+}
+
+/** with frame_cache_lock */
+static void
+cache_account_unref (GstDucatiCacheAccount * account)
+{
+  if (--account->refcount == 0) {
+    g_free (account);
+  }
+}
+
+void
+gst_ducati_cache_account_unref (GstDucatiCacheAccount * account)
+{
+  g_static_mutex_lock (&frame_cache_lock);
+  cache_account_unref (account);
+  g_static_mutex_unlock (&frame_cache_lock);
+}
+
+/** with frame_cache_lock.  Move entries beyond the max number cached, or
+ * cached for too long (or all of them), to 'expired'
+ */
+static void
+frame_cache_expire (GList ** expired, gboolean all)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GList *l = g_list_last (frame_cache);
+
+  while (l) {
+    CachedFrame *f = l->data;
+    GList *prev = l->prev;
+
+    if (!all && (frame_cache_len <= frame_cache_size) &&
+        (now - f->time < FRAME_CACHE_TIMEOUT)) {
+      /* everything before it was cached more recently: */
+      break;
+    }
+
+    frame_cache = g_list_remove_link (frame_cache, l);
+    frame_cache_len--;
+    f->account->n_cached--;
+    cache_account_unref (f->account);
+    *expired = g_list_concat (l, *expired);
+
+    l = prev;
+  }
+}
+
+static void
+frame_cache_free (GList * frames)
+{
+  GList *l;
+
+  for (l = frames; l; l = l->next) {
+    CachedFrame *f = l->data;
+    MemMgr_Free (f->data);
+    g_free (f);
+  }
+  g_list_free (frames);
+}
+
+static void frame_cache_schedule (void);
+
+static gboolean
+frame_cache_timeout_cb (GstClock * clock, GstClockTime time, GstClockID id,
+    gpointer user_data)
+{
+  GList *expired = NULL;
+
+  g_static_mutex_lock (&frame_cache_lock);
+  if (id == frame_cache_timer) {
+    gst_clock_id_unref (frame_cache_timer);
+    frame_cache_timer = NULL;
+    frame_cache_expire (&expired, FALSE);
+    frame_cache_schedule ();
+  }
+  g_static_mutex_unlock (&frame_cache_lock);
+
+  if (expired) {
+    GST_DEBUG ("freeing %u expired cached frames", g_list_length (expired));
+  }
+
+  frame_cache_free (expired);
+
+  return TRUE;
+}
+
+/** with frame_cache_lock.  Have the oldest entry expired once it has been
+ * cached for too long, even if nothing uses the cache anymore
+ */
+static void
+frame_cache_schedule (void)
+{
+  GList *l = g_list_last (frame_cache);
+  GstClockTime now, due;
+  GstClock *clock;
+
+  if (frame_cache_timer || !l) {
+    return;
+  }
+
+  now = gst_util_get_timestamp ();
+  due = ((CachedFrame *) l->data)->time + FRAME_CACHE_TIMEOUT;
+
+  clock = gst_system_clock_obtain ();
+  frame_cache_timer = gst_clock_new_single_shot_id (clock,
+      gst_clock_get_time (clock) + ((due > now) ? (due - now) : 0));
+  gst_clock_id_wait_async (frame_cache_timer, frame_cache_timeout_cb, NULL);
+  gst_object_unref (clock);
+}
+
+/** take memory for a buffer of 'pool' out of the cache, if there is any */
+static guint8 *
+frame_cache_get (GstDucatiBufferPool * pool)
+{
+  GList *l, *expired = NULL;
+  guint8 *data = NULL;
+
+  g_static_mutex_lock (&frame_cache_lock);
+  frame_cache_expire (&expired, FALSE);
+  for (l = frame_cache; l; l = l->next) {
+    CachedFrame *f = l->data;
+    if (pool->size ? (f->size == pool->headroom + pool->size) :
+        (!f->size && (f->width == pool->padded_width) &&
+            (f->height == pool->padded_height))) {
+      data = f->data;
+      pool->frame_size = f->frame_size;
+      frame_cache = g_list_delete_link (frame_cache, l);
+      frame_cache_len--;
+      f->account->n_cached--;
+      cache_account_unref (f->account);
+      g_free (f);
+      break;
+    }
+  }
+  g_static_mutex_unlock (&frame_cache_lock);
+
+  frame_cache_free (expired);
+
+  return data;
+}
+
+/** put the memory of a buffer of 'pool' in the cache, or free it if the
+ * pool already has as many buffers there as it is allowed
+ */
+static void
+frame_cache_put (GstDucatiBufferPool * pool, guint8 * data)
+{
+  GList *expired = NULL;
+
+  g_static_mutex_lock (&frame_cache_lock);
+  if (frame_cache_size && (pool->account->n_cached < pool->cache_quota)) {
+    CachedFrame *f = g_new0 (CachedFrame, 1);
+
+    f->data = data;
+    if (pool->size) {
+      f->size = pool->headroom + pool->size;
+    } else {
+      f->width = pool->padded_width;
+      f->height = pool->padded_height;
+    }
+    f->frame_size = pool->frame_size;
+    f->time = gst_util_get_timestamp ();
+    f->account = pool->account;
+    f->account->refcount++;
+    f->account->n_cached++;
+
+    frame_cache = g_list_prepend (frame_cache, f);
+    frame_cache_len++;
+    data = NULL;
+  }
+  frame_cache_expire (&expired, FALSE);
+  frame_cache_schedule ();
+  g_static_mutex_unlock (&frame_cache_lock);
+
+  if (data) {
+    MemMgr_Free (data);
+  }
+  frame_cache_free (expired);
+}
+
+/** set the max number of buffers kept in the frame cache */
+void
+gst_ducati_frame_cache_set_size (guint size)
+{
+  GList *expired = NULL;
+
+  g_static_mutex_lock (&frame_cache_lock);
+  frame_cache_size = size;
+  frame_cache_expire (&expired, FALSE);
+  g_static_mutex_unlock (&frame_cache_lock);
+
+  frame_cache_free (expired);
+}
+
+/** free everything in the frame cache */
+void
+gst_ducati_frame_cache_flush (void)
+{
+  GList *expired = NULL;
+
+  g_static_mutex_lock (&frame_cache_lock);
+  frame_cache_expire (&expired, TRUE);
+  g_static_mutex_unlock (&frame_cache_lock);
+
+  if (expired) {
+    GST_DEBUG ("freeing %u cached frames", g_list_length (expired));
+  }
+
+  frame_cache_free (expired);
+}
+
 /*
  * GstDucatiBuffer
  */
@@ -44,6 +412,7 @@ gst_ducati_buffer_new (GstDucatiBufferPool * pool)
 {
   GstDucatiBuffer *self = (GstDucatiBuffer *)
       gst_mini_object_new (GST_TYPE_DUCATIBUFFER);
+  guint8 *data;
   guint sz;
 
   GST_LOG_OBJECT (pool->element, "creating buffer %p in pool %p", self, pool);
@@ -51,9 +420,26 @@ gst_ducati_buffer_new (GstDucatiBufferPool * pool)
   self->pool = (GstDucatiBufferPool *)
       gst_mini_object_ref (GST_MINI_OBJECT (pool));
 
-  GST_BUFFER_DATA (self) =
-      gst_ducati_alloc_2d (pool->padded_width, pool->padded_height, &sz);
-  GST_BUFFER_SIZE (self) = sz;
+  data = frame_cache_get (pool);
+  if (data) {
+    GST_LOG_OBJECT (pool->element, "using cached frame %p", data);
+  } else if (pool->size) {
+    data = gst_ducati_alloc_1d (pool->headroom + pool->size);
+    pool->frame_size = pool->size;
+  } else {
+    data = gst_ducati_alloc_2d (pool->padded_width, pool->padded_height, &sz);
+    pool->frame_size = sz;
+  }
+
+  GST_BUFFER_DATA (self) = data ? data + pool->headroom : NULL;
+  GST_BUFFER_SIZE (self) = pool->frame_size;
+
+  if (G_UNLIKELY (!GST_BUFFER_DATA (self))) {
+    GST_ERROR_OBJECT (pool->element, "could not allocate buffer");
+    self->discard = TRUE;
+    gst_buffer_unref (GST_BUFFER (self));
+    return NULL;
+  }
 
   gst_buffer_set_caps (GST_BUFFER (self), pool->caps);
 
@@ -68,27 +454,58 @@ gst_ducati_buffer_finalize (GstDucatiBuffer * self)
 
   GST_LOG_OBJECT (pool->element, "finalizing buffer %p", self);
 
-  GST_DUCATI_BUFFERPOOL_LOCK (pool);
-  if (pool->running) {
+  /* _destroy() waits for 'releasing' to drop to zero after clearing
+   * 'running', so a buffer can't end up on the freelist after it was
+   * emptied:
+   */
+  g_atomic_int_inc (&pool->releasing);
+  if (g_atomic_int_get (&pool->running) && !self->discard &&
+      !(pool->max_buffers &&
+          (g_atomic_int_get (&pool->n_buffers) > (gint) pool->max_buffers)) &&
+      !(pool->high_water &&
+          (g_atomic_int_get (&pool->n_free) >= (gint) pool->high_water) &&
+          (g_atomic_int_get (&pool->n_buffers) > (gint) pool->min_buffers))) {
     resuscitated = TRUE;
 
     GST_LOG_OBJECT (pool->element, "reviving buffer %p", self);
     gst_buffer_ref (GST_BUFFER (self));
 
-    /* insert self into freelist */
-    self->next = pool->freelist;
-    pool->freelist = self;
+    self->released = gst_util_get_timestamp ();
+    freelist_push (pool, self);
+
+    /* wake up _get() if it is waiting for a buffer.  If it starts waiting
+     * after we check, it will find this buffer on the freelist first:
+     */
+    if (g_atomic_int_get (&pool->waiting)) {
+      g_mutex_lock (pool->lock);
+      g_cond_broadcast (pool->cond);
+      g_mutex_unlock (pool->lock);
+    }
   } else {
-    GST_LOG_OBJECT (pool->element, "the pool is shutting down");
+    GST_LOG_OBJECT (pool->element, "the pool is shutting down, or there "
+        "are enough (or too many) buffers");
   }
-  GST_DUCATI_BUFFERPOOL_UNLOCK (pool);
+  g_atomic_int_add (&pool->releasing, -1);
 
   if (!resuscitated) {
     GST_LOG_OBJECT (pool->element,
         "buffer %p (data %p, len %u) not recovered, freeing",
         self, GST_BUFFER_DATA (self), GST_BUFFER_SIZE (self));
-    MemMgr_Free ((void *) GST_BUFFER_DATA (self));
-    GST_BUFFER_DATA (self) = NULL;
+    if (GST_BUFFER_DATA (self)) {
+      guint8 *data = GST_BUFFER_DATA (self) - pool->headroom;
+
+      /* only the buffers of a pool that is gone are worth caching, the ones
+       * a live pool frees (trimmed, or over the limits) are meant to free
+       * memory:
+       */
+      if (g_atomic_int_get (&pool->running)) {
+        MemMgr_Free (data);
+      } else {
+        frame_cache_put (pool, data);
+      }
+      GST_BUFFER_DATA (self) = NULL;
+    }
+    g_atomic_int_add (&pool->n_buffers, -1);
     gst_mini_object_unref (GST_MINI_OBJECT (pool));
     GST_MINI_OBJECT_CLASS (buffer_parent_class)->
         finalize (GST_MINI_OBJECT (self));
@@ -129,70 +546,364 @@ gst_ducati_buffer_get_type (void)
 
 static GstMiniObjectClass *bufferpool_parent_class = NULL;
 
-/** create new bufferpool */
+/** when memory runs out, free all the free buffers beyond min_buffers right
+ * away, so the allocation can be retried.  This is called from whatever
+ * thread an allocation failed in, including the one calling _get()
+ */
+static void
+bufferpool_shrink (GstDucatiBufferPool * self)
+{
+  GST_DEBUG_OBJECT (self->element, "shrinking pool, %d buffers free",
+      g_atomic_int_get (&self->n_free));
+  gst_ducati_bufferpool_trim (self, 0, self->min_buffers);
+}
+
+/** create new bufferpool of at least 'min_buffers', which are allocated
+ * right away, and at most 'max_buffers' (0 = no limit) buffers
+ */
 GstDucatiBufferPool *
-gst_ducati_bufferpool_new (GstElement * element, GstCaps * caps)
+gst_ducati_bufferpool_new (GstElement * element, GstCaps * caps,
+    guint min_buffers, guint max_buffers)
 {
   GstDucatiBufferPool *self = (GstDucatiBufferPool *)
       gst_mini_object_new (GST_TYPE_DUCATIBUFFERPOOL);
   GstStructure *s = gst_caps_get_structure (caps, 0);
+  guint i;
 
   self->element = gst_object_ref (element);
   gst_structure_get_int (s, "width", &self->padded_width);
   gst_structure_get_int (s, "height", &self->padded_height);
   self->caps = gst_caps_ref (caps);
-  self->freelist = NULL;
+  self->freelist = 0;
   self->lock = g_mutex_new ();
+  g_static_rec_mutex_init (&self->pop_lock);
+  self->cond = g_cond_new ();
+  self->min_buffers = min_buffers;
+  self->max_buffers = max_buffers ? MAX (max_buffers, min_buffers) : 0;
+  self->timeout = GST_DUCATI_BUFFERPOOL_DEFAULT_TIMEOUT;
+  self->cache_quota = GST_DUCATI_BUFFERPOOL_DEFAULT_CACHE_QUOTA;
+  self->account = gst_ducati_cache_account_new ();
   self->running = TRUE;
 
+  GST_DEBUG_OBJECT (element, "preallocating %u buffers (max %u)",
+      min_buffers, self->max_buffers);
+
+  /* so the first frames don't have to wait for allocation: */
+  for (i = 0; i < min_buffers; i++) {
+    GstDucatiBuffer *buf;
+
+    g_atomic_int_inc (&self->n_buffers);
+    buf = gst_ducati_buffer_new (self);
+    if (!buf) {
+      break;
+    }
+    buf->released = gst_util_get_timestamp ();
+    freelist_push (self, buf);
+  }
+
+  gst_ducati_shrink_func_add ((GstDucatiShrinkFunc) bufferpool_shrink, self);
+
   return self;
 }
 
+/** create new bufferpool of 1D buffers of 'size' bytes, with 'headroom'
+ * bytes of space reserved in front of the buffer data
+ */
+GstDucatiBufferPool *
+gst_ducati_bufferpool_new_1d (GstElement * element, GstCaps * caps,
+    guint size, guint headroom)
+{
+  GstDucatiBufferPool *self = (GstDucatiBufferPool *)
+      gst_mini_object_new (GST_TYPE_DUCATIBUFFERPOOL);
+
+  self->element = gst_object_ref (element);
+  self->size = size;
+  self->headroom = headroom;
+  self->caps = gst_caps_ref (caps);
+  self->freelist = 0;
+  self->lock = g_mutex_new ();
+  g_static_rec_mutex_init (&self->pop_lock);
+  self->cond = g_cond_new ();
+  self->cache_quota = GST_DUCATI_BUFFERPOOL_DEFAULT_CACHE_QUOTA;
+  self->account = gst_ducati_cache_account_new ();
+  self->running = TRUE;
+
+  gst_ducati_shrink_func_add ((GstDucatiShrinkFunc) bufferpool_shrink, self);
+
+  return self;
+}
+
+/** count the pool's buffers in the frame cache against 'account' (shared
+ * with other pools) rather than its own
+ */
+void
+gst_ducati_bufferpool_set_cache_account (GstDucatiBufferPool * self,
+    GstDucatiCacheAccount * account)
+{
+  g_return_if_fail (self && account);
+
+  g_static_mutex_lock (&frame_cache_lock);
+  account->refcount++;
+  cache_account_unref (self->account);
+  self->account = account;
+  g_static_mutex_unlock (&frame_cache_lock);
+}
+
 /** destroy existing bufferpool */
 void
 gst_ducati_bufferpool_destroy (GstDucatiBufferPool * self)
 {
+  GstDucatiBuffer *buf;
+
   g_return_if_fail (self);
 
-  GST_DUCATI_BUFFERPOOL_LOCK (self);
-  self->running = FALSE;
-  GST_DUCATI_BUFFERPOOL_UNLOCK (self);
+  gst_ducati_shrink_func_remove ((GstDucatiShrinkFunc) bufferpool_shrink,
+      self);
+
+  g_atomic_int_set (&self->running, FALSE);
 
-  GST_DEBUG_OBJECT (self->element, "destroy pool");
+  /* wake up _get() if waiting: */
+  g_mutex_lock (self->lock);
+  g_cond_broadcast (self->cond);
+  g_mutex_unlock (self->lock);
+
+  /* wait for any buffer being returned right now to make it to the
+   * freelist:
+   */
+  while (g_atomic_int_get (&self->releasing)) {
+    g_thread_yield ();
+  }
+
+  GST_DEBUG_OBJECT (self->element, "destroy pool: %u hits, %u misses",
+      self->hits, self->misses);
 
   /* free all buffers on the freelist */
-  while (self->freelist) {
-    GstDucatiBuffer *buf = self->freelist;
-    self->freelist = buf->next;
+  while ((buf = freelist_pop (self))) {
     gst_buffer_unref (GST_BUFFER (buf));
   }
 
   gst_mini_object_unref (GST_MINI_OBJECT (self));
 }
 
-/** get buffer from bufferpool, allocate new buffer if needed */
-GstDucatiBuffer *
-gst_ducati_bufferpool_get (GstDucatiBufferPool * self, GstBuffer * orig)
+/** while flushing, _get() returns NULL instead of waiting for a buffer */
+void
+gst_ducati_bufferpool_set_flushing (GstDucatiBufferPool * self,
+    gboolean flushing)
+{
+  g_return_if_fail (self);
+
+  g_mutex_lock (self->lock);
+  g_atomic_int_set (&self->flushing, flushing);
+  g_cond_broadcast (self->cond);
+  g_mutex_unlock (self->lock);
+}
+
+/** set the caps of buffers returned by _get() from now on, for ex. when
+ * reusing a pool for a different resolution that its buffers fit.  Must
+ * be called from the thread that calls _get()
+ */
+void
+gst_ducati_bufferpool_set_caps (GstDucatiBufferPool * self, GstCaps * caps)
+{
+  GstCaps *old;
+
+  g_return_if_fail (self);
+
+  old = self->caps;
+  self->caps = gst_caps_ref (caps);
+  gst_caps_unref (old);
+}
+
+/** free buffers that have been on the freelist for at least 'idle', as long
+ * as at least 'keep' buffers stay allocated.  The most recently used ones
+ * are kept.  Can be called from any thread
+ */
+void
+gst_ducati_bufferpool_trim (GstDucatiBufferPool * self, GstClockTime idle,
+    guint keep)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GstDucatiBuffer *buf, *kept = NULL, *freed = NULL;
+  guint n_freed = 0;
+  gint n;
+
+  g_return_if_fail (self);
+
+  /* nothing else is popped until the kept buffers are back, so _get()
+   * doesn't allocate in the mean time, and concurrent trims don't free
+   * more than they should:
+   */
+  g_static_rec_mutex_lock (&self->pop_lock);
+
+  n = g_atomic_int_get (&self->n_buffers);
+  self->last_trim = now;
+
+  /* take everything off the freelist, most recently used first: */
+  while ((buf = freelist_pop (self))) {
+    if ((n > (gint) keep) && (now - buf->released >= idle)) {
+      buf->discard = TRUE;
+      buf->next = freed;
+      freed = buf;
+      n--;
+      n_freed++;
+    } else {
+      buf->next = kept;
+      kept = buf;
+    }
+  }
+
+  /* 'kept' is in reverse order now, so the most recently used ones end up
+   * on top again:
+   */
+  while ((buf = kept)) {
+    kept = buf->next;
+    freelist_push (self, buf);
+  }
+
+  g_static_rec_mutex_unlock (&self->pop_lock);
+
+  if (g_atomic_int_get (&self->waiting)) {
+    g_mutex_lock (self->lock);
+    g_cond_broadcast (self->cond);
+    g_mutex_unlock (self->lock);
+  }
+
+  if (n_freed) {
+    GST_DEBUG_OBJECT (self->element, "freeing %u idle buffers", n_freed);
+  }
+
+  while ((buf = freed)) {
+    freed = buf->next;
+    gst_buffer_unref (GST_BUFFER (buf));
+  }
+}
+
+/** allocate a new buffer, unless there are already max_buffers */
+static GstDucatiBuffer *
+bufferpool_alloc (GstDucatiBufferPool * self)
+{
+  gint n;
+
+  do {
+    n = g_atomic_int_get (&self->n_buffers);
+    if (self->max_buffers && (n >= (gint) self->max_buffers)) {
+      return NULL;
+    }
+  } while (!g_atomic_int_compare_and_exchange (&self->n_buffers, n, n + 1));
+
+  g_atomic_int_inc (&self->misses);
+
+  return gst_ducati_buffer_new (self);
+}
+
+/** wait for a buffer to be returned to the freelist, or allocate one past
+ * the limit if it takes longer than the timeout (which is freed again rather
+ * than kept once returned, while the pool is over the limit).  Returns NULL
+ * if flushing
+ */
+static GstDucatiBuffer *
+bufferpool_wait (GstDucatiBufferPool * self)
 {
   GstDucatiBuffer *buf = NULL;
+  gboolean overflow = FALSE;
+  GTimeVal deadline;
+
+  GST_DEBUG_OBJECT (self->element, "all %u buffers in use, waiting",
+      self->max_buffers);
+
+  g_get_current_time (&deadline);
+  g_time_val_add (&deadline, self->timeout / GST_USECOND);
+
+  g_mutex_lock (self->lock);
+  g_atomic_int_inc (&self->waiting);
+  while (g_atomic_int_get (&self->running) &&
+      !g_atomic_int_get (&self->flushing)) {
+    buf = freelist_pop (self);
+    if (buf) {
+      g_atomic_int_inc (&self->hits);
+      break;
+    }
+    if (!g_cond_timed_wait (self->cond, self->lock, &deadline)) {
+      buf = freelist_pop (self);
+      if (buf) {
+        g_atomic_int_inc (&self->hits);
+      } else {
+        overflow = TRUE;
+      }
+      break;
+    }
+  }
+  g_atomic_int_add (&self->waiting, -1);
+  g_mutex_unlock (self->lock);
+
+  /* (not holding the lock, since if the allocation fails, the pool may be
+   * asked to shrink)
+   */
+  if (overflow) {
+    GST_WARNING_OBJECT (self->element, "no buffer returned after %"
+        GST_TIME_FORMAT ", allocating more than %u",
+        GST_TIME_ARGS (self->timeout), self->max_buffers);
+    g_atomic_int_inc (&self->n_buffers);
+    g_atomic_int_inc (&self->misses);
+    buf = gst_ducati_buffer_new (self);
+  }
 
-  g_return_val_if_fail (self, NULL);
+  return buf;
+}
+
+static GstDucatiBuffer *
+bufferpool_get (GstDucatiBufferPool * self, GstBuffer * orig, gboolean wait)
+{
+  GstDucatiBuffer *buf = NULL;
+
+  if (g_atomic_int_get (&self->running)) {
+    if (self->idle_timeout &&
+        (gst_util_get_timestamp () - self->last_trim >= self->idle_timeout)) {
+      gst_ducati_bufferpool_trim (self, self->idle_timeout,
+          self->min_buffers);
+    }
 
-  GST_DUCATI_BUFFERPOOL_LOCK (self);
-  if (self->running) {
     /* re-use a buffer off the freelist if any are available
      */
-    if (self->freelist) {
-      buf = self->freelist;
-      self->freelist = buf->next;
+    buf = freelist_pop (self);
+    if (buf) {
+      g_atomic_int_inc (&self->hits);
     } else {
-      buf = gst_ducati_buffer_new (self);
+      buf = bufferpool_alloc (self);
+    }
+
+    if (!buf && wait) {
+      /* keep the pool alive while waiting, in case it is destroyed: */
+      gst_mini_object_ref (GST_MINI_OBJECT (self));
+      buf = bufferpool_wait (self);
+      gst_mini_object_unref (GST_MINI_OBJECT (self));
     }
-    buf->orig = orig;
   }
-  GST_DUCATI_BUFFERPOOL_UNLOCK (self);
 
-  if (buf && orig) {
+  if (!buf) {
+    if (orig) {
+      gst_buffer_unref (orig);
+    }
+    return NULL;
+  }
+
+  buf->orig = orig;
+
+  if (G_UNLIKELY (GST_BUFFER_CAPS (buf) != self->caps)) {
+    gst_buffer_set_caps (GST_BUFFER (buf), self->caps);
+  }
+
+  if (self->size) {
+    /* whoever had the buffer before may have changed size/flags/etc: */
+    GST_BUFFER_SIZE (buf) = self->size;
+    GST_BUFFER_FLAGS (buf) = 0;
+    GST_BUFFER_TIMESTAMP (buf) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION (buf) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_OFFSET (buf) = GST_BUFFER_OFFSET_NONE;
+    GST_BUFFER_OFFSET_END (buf) = GST_BUFFER_OFFSET_NONE;
+  }
+
+  if (orig) {
     GST_BUFFER_TIMESTAMP (buf) = GST_BUFFER_TIMESTAMP (orig);
     GST_BUFFER_DURATION (buf) = GST_BUFFER_DURATION (orig);
   }
@@ -200,10 +911,39 @@ gst_ducati_bufferpool_get (GstDucatiBufferPool * self, GstBuffer * orig)
   return buf;
 }
 
+/** get buffer from bufferpool, allocate new buffer if needed, or wait for
+ * one if the pool is at its max size.  Consumes the reference to 'orig'.
+ * Must only be called from one thread at a time
+ */
+GstDucatiBuffer *
+gst_ducati_bufferpool_get (GstDucatiBufferPool * self, GstBuffer * orig)
+{
+  g_return_val_if_fail (self, NULL);
+
+  return bufferpool_get (self, orig, TRUE);
+}
+
+/** like _get(), but returns NULL rather than wait if the pool is at its max
+ * size
+ */
+GstDucatiBuffer *
+gst_ducati_bufferpool_try_get (GstDucatiBufferPool * self, GstBuffer * orig)
+{
+  g_return_val_if_fail (self, NULL);
+
+  return bufferpool_get (self, orig, FALSE);
+}
+
 static void
 gst_ducati_bufferpool_finalize (GstDucatiBufferPool * self)
 {
+  g_static_rec_mutex_free (&self->pop_lock);
   g_mutex_free (self->lock);
+  g_cond_free (self->cond);
+
+  g_static_mutex_lock (&frame_cache_lock);
+  cache_account_unref (self->account);
+  g_static_mutex_unlock (&frame_cache_lock);
   gst_caps_unref (self->caps);
   gst_object_unref (self->element);
   GST_MINI_OBJECT_CLASS (bufferpool_parent_class)->
@@ -36,6 +36,27 @@ GType gst_ducati_bufferpool_get_type (void);
 
 typedef struct _GstDucatiBufferPool GstDucatiBufferPool;
 typedef struct _GstDucatiBuffer GstDucatiBuffer;
+typedef struct _GstDucatiCacheAccount GstDucatiCacheAccount;
+
+/* building with GST_DUCATI_FREELIST_LOCKED forces the locked freelist even
+ * where there is a double-width compare-and-swap, to compare the two:
+ */
+#ifdef GST_DUCATI_FREELIST_LOCKED
+#  undef HAVE_DWCAS
+#endif
+
+/* head of a freelist: pointer to the first buffer in the low half, and a
+ * tag in the high half, so both can be swapped with one compare-and-swap.
+ * Where there is no such compare-and-swap (HAVE_DWCAS is set by configure),
+ * just the pointer, protected by a lock
+ */
+#ifndef HAVE_DWCAS
+typedef GstDucatiBuffer *GstDucatiFreelist;
+#elif GLIB_SIZEOF_VOID_P == 4
+typedef guint64 GstDucatiFreelist;
+#else
+typedef unsigned __int128 GstDucatiFreelist;
+#endif
 
 struct _GstDucatiBufferPool
 {
@@ -44,19 +65,93 @@ struct _GstDucatiBufferPool
   /* output (padded) size including any codec padding: */
   gint padded_width, padded_height;
 
+  /* for pools of 1D buffers, the buffer size and the space reserved in
+   * front of the buffer data (otherwise zero, for 2D NV12 buffers):
+   */
+  guint size, headroom;
+
   GstCaps         *caps;
-  GMutex          *lock;
-  gboolean         running;  /* with lock */
+  volatile gint    running;  /* atomic */
   GstElement      *element;  /* the element that owns us.. */
-  GstDucatiBuffer *freelist; /* list of available buffers */
+
+  /* lock-free stack of available buffers.  The tag is changed on every
+   * push and pop, so a pop that raced with another pop and push of the
+   * same buffer (ABA) fails instead of corrupting the list:
+   */
+  volatile GstDucatiFreelist freelist;
+
+  /* number of buffers being returned to the freelist right now (atomic): */
+  volatile gint releasing;
+
+  /* number of buffers allocated up front, and max number of buffers (0 =
+   * no limit).  At the limit, _get() waits up to 'timeout' for a buffer to
+   * be returned, unless flushing, before allocating one anyways.  Buffers
+   * returned while there are more than max_buffers are freed.  The owner
+   * may change max_buffers at any time:
+   */
+  guint min_buffers, max_buffers;
+  GstClockTime timeout;
+  volatile gint n_buffers;   /* atomic */
+  volatile gint flushing;    /* atomic */
+
+  /* for waiting for a buffer to be returned, only used at the limit: */
+  GMutex *lock;
+  GCond *cond;
+  volatile gint waiting;     /* atomic */
+
+  /* free buffers idle for longer than idle_timeout (0 = never) are freed
+   * on the next _get(), and no more than high_water (0 = no limit) are
+   * kept free, but at least min_buffers are kept allocated:
+   */
+  GstClockTime idle_timeout;
+  guint high_water;
+  volatile gint n_free;      /* atomic */
+  GstClockTime last_trim;
+
+  /* serializes taking buffers off the freelist, since _trim() frees some of
+   * what it takes off, and can be called from any thread when memory runs
+   * out (recursive, _trim() holds it while popping everything):
+   */
+  GStaticRecMutex pop_lock;
+
+  /* when the owner stopped getting buffers from the pool, but kept it for
+   * reuse (for ex. when the resolution changed, in case it changes back):
+   */
+  GstClockTime retired;
+
+  /* max number of buffers that are kept in the plugin wide frame cache once
+   * freed, for any pool with the same geometry to use (0 = none), and the
+   * count of those still in the cache, which can be shared by several pools
+   * (for ex. all those of one element) so that the max applies to them all:
+   */
+  guint cache_quota;
+  GstDucatiCacheAccount *account;
+  guint frame_size;          /* allocated size of a buffer */
+
+  /* number of gets served from the freelist, vs newly allocated buffers
+   * (atomic):
+   */
+  volatile gint hits, misses;
 };
 
-GstDucatiBufferPool * gst_ducati_bufferpool_new (GstElement * element, GstCaps * caps);
+GstDucatiBufferPool * gst_ducati_bufferpool_new (GstElement * element, GstCaps * caps, guint min_buffers, guint max_buffers);
+GstDucatiBufferPool * gst_ducati_bufferpool_new_1d (GstElement * element, GstCaps * caps, guint size, guint headroom);
 void gst_ducati_bufferpool_destroy (GstDucatiBufferPool * pool);
+void gst_ducati_bufferpool_set_flushing (GstDucatiBufferPool * self, gboolean flushing);
+void gst_ducati_bufferpool_trim (GstDucatiBufferPool * self, GstClockTime idle, guint keep);
+void gst_ducati_bufferpool_set_caps (GstDucatiBufferPool * self, GstCaps * caps);
+void gst_ducati_bufferpool_set_cache_account (GstDucatiBufferPool * self, GstDucatiCacheAccount * account);
+
+GstDucatiCacheAccount * gst_ducati_cache_account_new (void);
+void gst_ducati_cache_account_unref (GstDucatiCacheAccount * account);
+
+void gst_ducati_frame_cache_set_size (guint size);
+void gst_ducati_frame_cache_flush (void);
 GstDucatiBuffer * gst_ducati_bufferpool_get (GstDucatiBufferPool * self, GstBuffer * orig);
+GstDucatiBuffer * gst_ducati_bufferpool_try_get (GstDucatiBufferPool * self, GstBuffer * orig);
 
-#define GST_DUCATI_BUFFERPOOL_LOCK(self)     g_mutex_lock ((self)->lock)
-#define GST_DUCATI_BUFFERPOOL_UNLOCK(self)   g_mutex_unlock ((self)->lock)
+#define GST_DUCATI_BUFFERPOOL_DEFAULT_TIMEOUT  GST_SECOND
+#define GST_DUCATI_BUFFERPOOL_DEFAULT_CACHE_QUOTA  4
 
 struct _GstDucatiBuffer {
   GstBuffer parent;
@@ -64,6 +159,8 @@ struct _GstDucatiBuffer {
   GstDucatiBufferPool *pool; /* buffer-pool that this buffer belongs to */
   GstBuffer       *orig;     /* original buffer, if we need to copy output */
   GstDucatiBuffer *next;     /* next in freelist, if not in use */
+  GstClockTime released;     /* when it was put on the freelist */
+  gboolean discard;          /* free instead of returning to the freelist */
 };
 
 GstBuffer * gst_ducati_buffer_get (GstDucatiBuffer * self);
@@ -67,6 +67,7 @@ gst_ducati_h264dec_update_buffer_size (GstDucatiVidDec * self)
   self->padded_width = ALIGN2 (w + (2 * PADX), 7);
   self->padded_height = h + 4 * PADY;
   self->min_buffers = MIN (16, 32768 / ((w / 16) * (h / 16))) + 3;
+  self->max_display_delay = self->min_buffers - 3;
 }
 
 static gboolean
@@ -91,6 +92,121 @@ gst_ducati_h264dec_allocate_params (GstDucatiVidDec * self, gint params_sz,
   return ret;
 }
 
+/** check an SEI NAL unit (without emulation prevention bytes removed, which
+ * is fine for just the message headers) for a recovery point message:
+ */
+static gboolean
+sei_has_recovery_point (const guint8 * data, guint size)
+{
+  guint i = 0;
+
+  while (i < size && data[i] != 0x80) {
+    guint type = 0, len = 0;
+
+    while (i < size && data[i] == 0xff)
+      type += data[i++];
+    if (i >= size)
+      break;
+    type += data[i++];
+
+    while (i < size && data[i] == 0xff)
+      len += data[i++];
+    if (i >= size)
+      break;
+    len += data[i++];
+
+    if (type == 6)              /* recovery_point */
+      return TRUE;
+
+    i += len;
+  }
+
+  return FALSE;
+}
+
+/** check a NAL unit: 1 if decoding can start at it, 0 if not, or -1 if it
+ * depends on the NAL units that follow
+ */
+static gint
+nal_is_sync_point (const guint8 * data, guint size)
+{
+  guint type = data[0] & 0x1f;
+
+  if (type == 5)                /* IDR slice */
+    return 1;
+  if (type == 1)                /* non-IDR slice, no recovery point before it */
+    return 0;
+  if (type == 6 && sei_has_recovery_point (data + 1, size - 1))
+    return 1;
+
+  return -1;
+}
+
+/** size of the NAL unit length fields if the stream is in AVC format (as
+ * from an mp4 demuxer, with an avcC record as codec_data), or 0 if it is
+ * a byte-stream with start codes
+ */
+static guint
+avc_nal_length_size (GstDucatiVidDec * self)
+{
+  const guint8 *cd;
+
+  if (!self->codec_data || GST_BUFFER_SIZE (self->codec_data) < 7)
+    return 0;
+
+  cd = GST_BUFFER_DATA (self->codec_data);
+  if (cd[0] != 1)               /* avcC configurationVersion */
+    return 0;
+
+  return (cd[4] & 0x03) + 1;
+}
+
+static gboolean
+gst_ducati_h264dec_is_sync_point (GstDucatiVidDec * self, GstBuffer * buf)
+{
+  const guint8 *data = GST_BUFFER_DATA (buf);
+  guint size = GST_BUFFER_SIZE (buf);
+  guint length_size = avc_nal_length_size (self);
+  guint i, j, len;
+  gint ret;
+
+  if (parent_class->is_sync_point (self, buf))
+    return TRUE;
+
+  /* the demuxer/parser only flags IDR frames, but decoding can also start
+   * at a recovery point (open-GOP streams often have no IDR frames at all).
+   * In AVC format, walk the NAL unit lengths, since a length can look like
+   * a start code:
+   */
+  if (length_size) {
+    for (i = 0; i + length_size < size; i += len) {
+      for (j = 0, len = 0; j < length_size; j++)
+        len = (len << 8) | data[i++];
+
+      if (len == 0 || len > size - i)
+        break;
+
+      ret = nal_is_sync_point (data + i, len);
+      if (ret >= 0)
+        return ret;
+    }
+
+    return FALSE;
+  }
+
+  for (i = 0; i + 3 < size; i++) {
+    if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+      continue;
+
+    i += 3;
+    ret = nal_is_sync_point (data + i, size - i);
+    if (ret >= 0)
+      return ret;
+  }
+
+  return FALSE;
+}
+
 /* GObject vmethod implementations */
 
 static void
@@ -113,10 +229,16 @@ gst_ducati_h264dec_class_init (GstDucatiH264DecClass * klass)
 {
   GstDucatiVidDecClass *bclass = GST_DUCATIVIDDEC_CLASS (klass);
   bclass->codec_name = "ivahd_h264dec";
+  /* note: only correct for streams without frame reordering, ie. those
+   * normally used for low latency (baseline profile):
+   */
+  bclass->low_latency_display_delay = IVIDDEC3_DECODE_ORDER;
   bclass->update_buffer_size =
       GST_DEBUG_FUNCPTR (gst_ducati_h264dec_update_buffer_size);
   bclass->allocate_params =
       GST_DEBUG_FUNCPTR (gst_ducati_h264dec_allocate_params);
+  bclass->is_sync_point =
+      GST_DEBUG_FUNCPTR (gst_ducati_h264dec_is_sync_point);
 }
 
 static void
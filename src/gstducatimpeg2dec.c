@@ -62,6 +62,8 @@ gst_ducati_mpeg2dec_update_buffer_size (GstDucatiVidDec * self)
   self->padded_width = ALIGN2 (w, 7);
   self->padded_height = h;
   self->min_buffers = 8;
+  /* B frames are only ever displayed before the preceding reference: */
+  self->max_display_delay = 1;
 }
 
 static gboolean
@@ -102,7 +104,7 @@ gst_ducati_mpeg2dec_push_input (GstDucatiVidDec * vdec, GstBuffer * buf)
           GST_BUFFER_SIZE (vdec->codec_data));
       self->prepend_codec_data = FALSE;
     }
-    push_input (vdec, data, sz);
+    push_input_buffer (vdec, buf);
   }
 
   gst_buffer_unref (buf);
@@ -40,6 +40,12 @@
 #define PADX  32
 #define PADY  32
 
+/* size of frame header, and how much bigger that is than the slice
+ * header in the input buffer which it replaces:
+ */
+#define FRAME_HEADER_SIZE(slice_count)  (20 + (8 * (slice_count)))
+#define FRAME_HEADER_HEADROOM           (FRAME_HEADER_SIZE (0) - 1)
+
 
 GST_BOILERPLATE (GstDucatiRVDec, gst_ducati_rvdec, GstDucatiVidDec,
     GST_TYPE_DUCATIVIDDEC);
@@ -121,6 +127,7 @@ gst_ducati_rvdec_push_input (GstDucatiVidDec * vdec, GstBuffer * buf)
   GstDucatiRVDec *self = GST_DUCATIRVDEC (vdec);
   guint8 *data;
   guint8 val[4];
+  guint8 hdr[FRAME_HEADER_SIZE (256)], *h;
   gint i, sz, slice_count;
 
   /* *** on first buffer, build up the stream header for the codec *** */
@@ -169,49 +176,55 @@ gst_ducati_rvdec_push_input (GstDucatiVidDec * vdec, GstBuffer * buf)
   /* payload size, excluding fixed header and slice header */
   sz -= 1 + (8 * slice_count);
 
-  /* *** insert frame header *** */
+  /* *** build frame header *** */
+  h = hdr;
+
   /* payload size */
-  GST_WRITE_UINT32_BE (val, sz);
-  push_input (vdec, val, 4);
+  GST_WRITE_UINT32_BE (h, sz);
+  h += 4;
 
   /* unknown? may be timestamp, hopefully decoder doesn't care */
-  GST_WRITE_UINT32_BE (val, 0x00000001);
-  push_input (vdec, val, 4);
+  GST_WRITE_UINT32_BE (h, 0x00000001);
+  h += 4;
 
   /* unknown? may be sequence number, hopefully decoder doesn't care */
-  GST_WRITE_UINT16_BE (val, 0x0000);
-  push_input (vdec, val, 2);
+  GST_WRITE_UINT16_BE (h, 0x0000);
+  h += 2;
 
   /* unknown? may indicate I frame, hopefully decoder doesn't care */
   if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
-    GST_WRITE_UINT16_BE (val, 0x0000);
+    GST_WRITE_UINT16_BE (h, 0x0000);
   } else {
-    GST_WRITE_UINT16_BE (val, 0x0002);
+    GST_WRITE_UINT16_BE (h, 0x0002);
   }
-  push_input (vdec, val, 2);
+  h += 2;
 
   /* unknown? seems to be always zeros */
-  GST_WRITE_UINT32_BE (val, 0x00000000);
-  push_input (vdec, val, 4);
+  GST_WRITE_UINT32_BE (h, 0x00000000);
+  h += 4;
 
   /* convert the slice_header to big endian, and note that the codec
    * expects to get slice_count rather than slice_count-1
    */
-  GST_WRITE_UINT32_BE (val, slice_count);
-  push_input (vdec, val, 4);
+  GST_WRITE_UINT32_BE (h, slice_count);
+  h += 4;
 
   for (i = 0; i < slice_count; i++) {
-    GST_WRITE_UINT32_BE (val, 0x00000001);
-    push_input (vdec, val, 4);
+    GST_WRITE_UINT32_BE (h, 0x00000001);
+    h += 4;
 
     data += 4;
-    GST_WRITE_UINT32_BE (val, GST_READ_UINT32_LE (data));
+    GST_WRITE_UINT32_BE (h, GST_READ_UINT32_LE (data));
     data += 4;
-    push_input (vdec, val, 4);
+    h += 4;
   }
 
-  /* copy the payload (rest of buffer) */
-  push_input (vdec, data, sz);
+  /* insert frame header and copy the payload (rest of buffer).  If the
+   * buffer came from our bufferalloc, the frame header just overwrites
+   * the slice header (plus headroom) instead:
+   */
+  push_input_with_header (vdec, hdr, h - hdr, buf,
+      data - GST_BUFFER_DATA (buf));
   gst_buffer_unref (buf);
 
   return NULL;
@@ -239,6 +252,7 @@ gst_ducati_rvdec_class_init (GstDucatiRVDecClass * klass)
 {
   GstDucatiVidDecClass *bclass = GST_DUCATIVIDDEC_CLASS (klass);
   bclass->codec_name = "ivahd_realvdec";
+  bclass->input_headroom = FRAME_HEADER_HEADROOM;
   bclass->parse_caps =
       GST_DEBUG_FUNCPTR (gst_ducati_rvdec_parse_caps);
   bclass->update_buffer_size =
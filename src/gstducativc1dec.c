@@ -166,10 +166,10 @@ gst_ducati_vc1dec_push_input (GstDucatiVidDec * vdec, GstBuffer * buf)
   /* VC-1 Advanced profile needs start-code prepended: */
   if (self->level == 4) {
     static guint8 sc[] = { 0x00, 0x00, 0x01, 0x0d };    /* start code */
-    push_input (vdec, sc, sizeof (sc));
+    push_input_with_header (vdec, sc, sizeof (sc), buf, 0);
+  } else {
+    push_input_buffer (vdec, buf);
   }
-
-  push_input (vdec, GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
   gst_buffer_unref (buf);
 
   return NULL;
@@ -198,6 +198,7 @@ gst_ducati_vc1dec_class_init (GstDucatiVC1DecClass * klass)
 {
   GstDucatiVidDecClass *bclass = GST_DUCATIVIDDEC_CLASS (klass);
   bclass->codec_name = "ivahd_vc1vdec";
+  bclass->input_headroom = 4;
   bclass->parse_caps =
       GST_DEBUG_FUNCPTR (gst_ducati_vc1dec_parse_caps);
   bclass->update_buffer_size =
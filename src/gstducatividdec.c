@@ -36,15 +36,74 @@ enum
 {
   PROP_0,
   PROP_VERSION,
+  PROP_THREADED,
+  PROP_QUEUE_SIZE,
+  PROP_INPUT_BUFFERS,
+  PROP_MAX_WIDTH,
+  PROP_MAX_HEIGHT,
+  PROP_PRIORITY,
+  PROP_DEADLINE,
+  PROP_ACCELERATOR_TIME,
+  PROP_REVERSE_MAX_FRAMES,
+  PROP_LOW_LATENCY,
+  PROP_SEEK_LATENCY,
+  PROP_MAX_ERRORS,
+  PROP_ERRORS,
+  PROP_RECOVERY_TIME,
+  PROP_WAIT_FOR_KEYFRAME,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_MAX_OUTPUT_BUFFERS,
+  PROP_POOL_TIMEOUT,
+  PROP_POOL_IDLE_TIMEOUT,
+  PROP_POOL_HIGH_WATER,
+  PROP_FRAME_CACHE_QUOTA,
 };
 
+#define DEFAULT_THREADED    FALSE
+#define DEFAULT_QUEUE_SIZE  4
+#define DEFAULT_INPUT_BUFFERS 2
+#define DEFAULT_MAX_WIDTH   0
+#define DEFAULT_MAX_HEIGHT  0
+#define DEFAULT_PRIORITY    0
+#define DEFAULT_DEADLINE    0
+#define DEFAULT_REVERSE_MAX_FRAMES 30
+#define DEFAULT_LOW_LATENCY FALSE
+#define DEFAULT_MAX_ERRORS  5
+#define DEFAULT_WAIT_FOR_KEYFRAME FALSE
+#define DEFAULT_STATS_INTERVAL 0
+#define DEFAULT_MAX_OUTPUT_BUFFERS 0
+#define DEFAULT_POOL_TIMEOUT 1000
+#define DEFAULT_POOL_IDLE_TIMEOUT 5000
+#define DEFAULT_POOL_HIGH_WATER 0
+#define DEFAULT_FRAME_CACHE_QUOTA GST_DUCATI_BUFFERPOOL_DEFAULT_CACHE_QUOTA
+
+/* frame skip modes, from least to most skipping, used when QoS events
+ * tell us we are late:
+ */
+static const XDAS_Int32 skip_modes[] = {
+  IVIDEO_NO_SKIP,
+  IVIDEO_SKIP_NONREFERENCE,
+  IVIDEO_SKIP_B,
+  IVIDEO_SKIP_PB,
+};
+
+/* segment rate above which only keyframes are decoded: */
+#define KEYFRAMES_ONLY_RATE 2.0
+
+/* number of consecutive late (or on time) QoS events before skipping more
+ * (or less):
+ */
+#define QOS_LATE_COUNT   2
+#define QOS_EARLY_COUNT  16
+
 /* helper functions */
 
 static void
 engine_close (GstDucatiVidDec * self)
 {
   if (self->engine) {
-    Engine_close (self->engine);
+    gst_ducati_engine_put (self->engine);
     self->engine = NULL;
   }
 
@@ -95,7 +154,7 @@ engine_open (GstDucatiVidDec * self)
 
   GST_DEBUG_OBJECT (self, "opening engine");
 
-  self->engine = Engine_open ((String)"ivahd_vidsvr", NULL, NULL);
+  self->engine = gst_ducati_engine_get ();
   if (G_UNLIKELY (!self->engine)) {
     GST_ERROR_OBJECT (self, "could not create engine");
     return FALSE;
@@ -106,26 +165,369 @@ engine_open (GstDucatiVidDec * self)
       sizeof (IVIDDEC3_Status), sizeof (IVIDDEC3_InArgs),
       sizeof (IVIDDEC3_OutArgs));
 
+  if (ret) {
+    self->display_delay = self->params->displayDelay;
+  }
+
   return ret;
 }
 
+#define OUTBUF_ID(idx, gen)   ((XDAS_Int32) ((((gen) & 0x7fffff) << 8) | ((idx) + 1)))
+#define OUTBUF_ID_IDX(id)     (((id) & 0xff) - 1)
+#define OUTBUF_ID_GEN(id)     (((id) >> 8) & 0x7fffff)
+
+/* queue of pending timestamps, sorted: */
+
+static void
+pts_insert (GstDucatiVidDec * self, GstClockTime ts)
+{
+  guint i;
+
+  if (G_UNLIKELY (self->n_pts == GST_DUCATIVIDDEC_MAX_OUTBUFS)) {
+    /* shouldn't happen, but drop the oldest rather than overflow: */
+    GST_WARNING_OBJECT (self, "too many pending timestamps");
+    memmove (&self->pts[0], &self->pts[1],
+        --self->n_pts * sizeof (self->pts[0]));
+  }
+
+  for (i = self->n_pts; (i > 0) && (self->pts[i - 1] > ts); i--) {
+    self->pts[i] = self->pts[i - 1];
+  }
+  self->pts[i] = ts;
+  self->n_pts++;
+}
+
+/** get the earliest pending timestamp */
+static GstClockTime
+pts_pop (GstDucatiVidDec * self)
+{
+  GstClockTime ts;
+
+  if (!self->n_pts) {
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  ts = self->pts[0];
+  memmove (&self->pts[0], &self->pts[1],
+      --self->n_pts * sizeof (self->pts[0]));
+
+  return ts;
+}
+
+/** remove the timestamp of a frame that won't be output */
+static void
+pts_remove (GstDucatiVidDec * self, GstClockTime ts)
+{
+  guint i;
+
+  for (i = 0; i < self->n_pts; i++) {
+    if (self->pts[i] == ts) {
+      memmove (&self->pts[i], &self->pts[i + 1],
+          (--self->n_pts - i) * sizeof (self->pts[0]));
+      return;
+    }
+  }
+}
+
+/* output buffer ID table: */
+
+/** add buffer to table (taking ownership of the reference), returning the
+ * ID to give the codec, or 0 if the table is full
+ */
+static XDAS_Int32
+outbuf_add (GstDucatiVidDec * self, GstBuffer * buf)
+{
+  GstDucatiVidDecOutBuf *slot;
+  guint idx;
+
+  if (G_UNLIKELY (!self->n_free_outbufs)) {
+    GST_ERROR_OBJECT (self, "too many output buffers held by codec");
+    gst_buffer_unref (buf);
+    return 0;
+  }
+
+  idx = self->free_outbufs[--self->n_free_outbufs];
+  slot = &self->outbufs[idx];
+  slot->buf = buf;
+  slot->locked = gst_util_get_timestamp ();
+  slot->ts = GST_BUFFER_TIMESTAMP (buf);
+  slot->duration = GST_BUFFER_DURATION (buf);
+  slot->output = FALSE;
+
+  if (GST_CLOCK_TIME_IS_VALID (slot->ts)) {
+    pts_insert (self, slot->ts);
+  }
+
+  self->n_locked++;
+  self->max_locked = MAX (self->max_locked, self->n_locked);
+
+  return OUTBUF_ID (idx, slot->gen);
+}
+
+/** lookup the table entry for an ID returned by the codec, or NULL if the
+ * ID is not valid (anymore)
+ */
+static GstDucatiVidDecOutBuf *
+outbuf_lookup (GstDucatiVidDec * self, XDAS_Int32 id)
+{
+  gint idx = OUTBUF_ID_IDX (id);
+  GstDucatiVidDecOutBuf *slot;
+
+  if (G_UNLIKELY ((idx < 0) || (idx >= GST_DUCATIVIDDEC_MAX_OUTBUFS))) {
+    GST_WARNING_OBJECT (self, "invalid buffer ID: %08x", id);
+    return NULL;
+  }
+
+  slot = &self->outbufs[idx];
+  if (G_UNLIKELY (!slot->buf || ((slot->gen & 0x7fffff) != OUTBUF_ID_GEN (id)))) {
+    GST_WARNING_OBJECT (self, "stale buffer ID: %08x", id);
+    return NULL;
+  }
+
+  return slot;
+}
+
+/** remove entry from the table, returning the buffer reference it held */
+static GstBuffer *
+outbuf_remove (GstDucatiVidDec * self, GstDucatiVidDecOutBuf * slot)
+{
+  GstBuffer *buf = slot->buf;
+  GstClockTime t = gst_util_get_timestamp () - slot->locked;
+
+  GST_LOG_OBJECT (self, "buffer %p locked for %" GST_TIME_FORMAT,
+      buf, GST_TIME_ARGS (t));
+
+  self->lock_count++;
+  self->lock_time_total += t;
+  self->lock_time_max = MAX (self->lock_time_max, t);
+  self->n_locked--;
+
+  slot->buf = NULL;
+  slot->gen++;
+  self->free_outbufs[self->n_free_outbufs++] = slot - self->outbufs;
+
+  return buf;
+}
+
+/** release any buffers still held by the codec, and reset the table */
+static void
+outbuf_reset (GstDucatiVidDec * self)
+{
+  guint i;
+
+  if (self->lock_count) {
+    GST_INFO_OBJECT (self, "output buffers: max %d locked, avg/max lock time "
+        "%" GST_TIME_FORMAT "/%" GST_TIME_FORMAT, self->max_locked,
+        GST_TIME_ARGS (self->lock_time_total / self->lock_count),
+        GST_TIME_ARGS (self->lock_time_max));
+  }
+
+  self->n_free_outbufs = 0;
+  for (i = GST_DUCATIVIDDEC_MAX_OUTBUFS; i > 0; i--) {
+    GstDucatiVidDecOutBuf *slot = &self->outbufs[i - 1];
+    if (slot->buf) {
+      gst_buffer_unref (slot->buf);
+      slot->buf = NULL;
+      slot->gen++;
+    }
+    self->free_outbufs[self->n_free_outbufs++] = i - 1;
+  }
+
+  self->n_locked = 0;
+  self->n_pts = 0;
+}
+
+/** destroy one of our bufferpools, keeping its stats */
+static void
+pool_destroy (GstDucatiVidDec * self, GstDucatiBufferPool ** ppool)
+{
+  GstDucatiBufferPool *pool;
+
+  GST_OBJECT_LOCK (self);
+  pool = *ppool;
+  *ppool = NULL;
+  self->pool_hits += pool->hits;
+  self->pool_misses += pool->misses;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_ducati_bufferpool_destroy (pool);
+}
+
+/** keep the output pool for reuse, rather than destroying it, since
+ * adaptive streams often switch back and forth between resolutions
+ */
+static void
+pool_retire (GstDucatiVidDec * self)
+{
+  GST_OBJECT_LOCK (self);
+  self->pool->retired = gst_util_get_timestamp ();
+  self->old_pools = g_list_prepend (self->old_pools, self->pool);
+  self->pool = NULL;
+  GST_OBJECT_UNLOCK (self);
+}
+
+static gboolean pool_age_out_cb (GstClock * clock, GstClockTime time,
+    GstClockID id, gpointer user_data);
+
+/** with object lock.  Have the oldest old output pool aged out once it has
+ * been unused for too long, even if we don't get any more output buffers
+ * from our pools (because downstream provides them, or the stream stopped),
+ * or cancel that if there are no old pools left
+ */
+static void
+pool_schedule_age_out (GstDucatiVidDec * self)
+{
+  GList *l = g_list_last (self->old_pools);
+  GstClockTime now, due;
+  GstClock *clock;
+
+  if (!l || !self->pool_idle_timeout) {
+    if (self->old_pools_timer) {
+      gst_clock_id_unschedule (self->old_pools_timer);
+      gst_clock_id_unref (self->old_pools_timer);
+      self->old_pools_timer = NULL;
+    }
+    return;
+  }
+
+  if (self->old_pools_timer) {
+    return;
+  }
+
+  now = gst_util_get_timestamp ();
+  due = ((GstDucatiBufferPool *) l->data)->retired + self->pool_idle_timeout;
+
+  clock = gst_system_clock_obtain ();
+  self->old_pools_timer = gst_clock_new_single_shot_id (clock,
+      gst_clock_get_time (clock) + ((due > now) ? (due - now) : 0));
+  gst_clock_id_wait_async_full (self->old_pools_timer, pool_age_out_cb,
+      gst_object_ref (self), (GDestroyNotify) gst_object_unref);
+  gst_object_unref (clock);
+}
+
+/** destroy old output pools that have not been reused for a while, or
+ * beyond the max number kept, or all of them
+ */
+static void
+pool_age_out (GstDucatiVidDec * self, gboolean all)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GList *l, *next, *expired = NULL;
+  guint n = 0;
+
+  GST_OBJECT_LOCK (self);
+  for (l = self->old_pools; l; l = next) {
+    GstDucatiBufferPool *pool = l->data;
+
+    next = l->next;
+    if (all || (++n > GST_DUCATIVIDDEC_MAX_OLD_POOLS) ||
+        (self->pool_idle_timeout &&
+            (now - pool->retired >= self->pool_idle_timeout))) {
+      self->pool_hits += pool->hits;
+      self->pool_misses += pool->misses;
+      self->old_pools = g_list_delete_link (self->old_pools, l);
+      expired = g_list_prepend (expired, pool);
+    }
+  }
+  pool_schedule_age_out (self);
+  GST_OBJECT_UNLOCK (self);
+
+  for (l = expired; l; l = l->next) {
+    GstDucatiBufferPool *pool = l->data;
+    GST_DEBUG_OBJECT (self, "destroying old %dx%d bufferpool",
+        pool->padded_width, pool->padded_height);
+    gst_ducati_bufferpool_destroy (pool);
+  }
+  g_list_free (expired);
+}
+
+static gboolean
+pool_age_out_cb (GstClock * clock, GstClockTime time, GstClockID id,
+    gpointer user_data)
+{
+  GstDucatiVidDec *self = GST_DUCATIVIDDEC (user_data);
+
+  GST_OBJECT_LOCK (self);
+  if (id != self->old_pools_timer) {
+    GST_OBJECT_UNLOCK (self);
+    return TRUE;
+  }
+  gst_clock_id_unref (self->old_pools_timer);
+  self->old_pools_timer = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  pool_age_out (self, FALSE);
+
+  return TRUE;
+}
+
+/** find an old output pool with buffers that fit the current resolution,
+ * the one with the smallest buffers if there is more than one
+ */
+static GstDucatiBufferPool *
+pool_reuse (GstDucatiVidDec * self)
+{
+  GstDucatiBufferPool *best = NULL;
+  GList *l;
+
+  GST_OBJECT_LOCK (self);
+  for (l = self->old_pools; l; l = l->next) {
+    GstDucatiBufferPool *pool = l->data;
+    if ((pool->padded_height == self->padded_height) &&
+        (pool->padded_width >= self->padded_width) &&
+        (!best || (pool->padded_width < best->padded_width))) {
+      best = pool;
+    }
+  }
+  if (best) {
+    self->old_pools = g_list_remove (self->old_pools, best);
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return best;
+}
+
+/** make the output pool stop (or resume) waiting for buffers, so a flush
+ * isn't blocked by the streaming thread waiting for downstream
+ */
+static void
+pool_set_flushing (GstDucatiVidDec * self, gboolean flushing)
+{
+  GST_OBJECT_LOCK (self);
+  self->pool_flushing = flushing;
+  if (self->pool) {
+    gst_ducati_bufferpool_set_flushing (self->pool, flushing);
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
 static void
 codec_delete (GstDucatiVidDec * self)
 {
+  /* release buffers still held by the codec before destroying the pool: */
+  outbuf_reset (self);
+
   if (self->pool) {
-    gst_ducati_bufferpool_destroy (self->pool);
-    self->pool = NULL;
+    pool_retire (self);
   }
 
   if (self->codec) {
-    VIDDEC3_delete(self->codec);
+    const gchar *codec_name = GST_DUCATIVIDDEC_GET_CLASS (self)->codec_name;
+    gint err;
+
+    /* if possible, keep the codec around for the next element that needs
+     * the same one, after making it forget the current stream:
+     */
+    err = VIDDEC3_control (self->codec, XDM_RESET,
+        self->dynParams, self->status);
+    if (err || !gst_ducati_codec_cache_put (codec_name, self->params,
+            self->codec, FALSE)) {
+      VIDDEC3_delete(self->codec);
+    }
     self->codec = NULL;
   }
 
-  if (self->input) {
-    MemMgr_Free (self->input);
-    self->input = NULL;
-  }
+  self->pending_id = 0;
 }
 
 static gboolean
@@ -141,15 +543,34 @@ codec_create (GstDucatiVidDec * self)
     return FALSE;
   }
 
-  /* these need to be set before VIDDEC3_create */
-  self->params->maxWidth = self->width;
-  self->params->maxHeight = self->height;
+  /* these need to be set before VIDDEC3_create.  If a max resolution is
+   * configured, create the codec for that so that resolution changes up to
+   * the max don't need a new codec:
+   */
+  self->params->maxWidth = MAX (self->width, ALIGN2 (self->max_width, 4));
+  self->params->maxHeight = MAX (self->height, ALIGN2 (self->max_height, 4));
+
+  /* in low-latency mode, output frames as soon as possible: */
+  self->params->displayDelay = self->display_delay;
+  if (self->low_latency) {
+    gint delay = GST_DUCATIVIDDEC_GET_CLASS (self)->low_latency_display_delay;
+    if ((self->display_delay == IVIDDEC3_DISPLAY_DELAY_AUTO) ||
+        (self->display_delay > delay)) {
+      self->params->displayDelay = delay;
+    }
+  }
 
   codec_name = GST_DUCATIVIDDEC_GET_CLASS (self)->codec_name;
 
-  /* create codec: */
-  GST_DEBUG_OBJECT (self, "creating codec: %s", codec_name);
-  self->codec = VIDDEC3_create (self->engine, (String)codec_name, self->params);
+  /* create codec, unless there is already one that can be used: */
+  self->codec = gst_ducati_codec_cache_get (codec_name, self->params);
+  if (self->codec) {
+    GST_DEBUG_OBJECT (self, "using cached codec: %s", codec_name);
+  } else {
+    GST_DEBUG_OBJECT (self, "creating codec: %s", codec_name);
+    self->codec = VIDDEC3_create (self->engine, (String)codec_name,
+        self->params);
+  }
 
   if (!self->codec) {
     return FALSE;
@@ -161,29 +582,262 @@ codec_create (GstDucatiVidDec * self)
     return FALSE;
   }
 
-  self->first_in_buffer = TRUE;
   self->first_out_buffer = TRUE;
 
-  /* allocate input buffer and initialize inBufs: */
+  /* initialize inBufs, buf is set to one of the input buffers per frame: */
   self->inBufs->numBufs = 1;
-  self->input = gst_ducati_alloc_1d (self->width * self->height);
-  self->inBufs->descs[0].buf = (XDAS_Int8 *) TilerMem_VirtToPhys (self->input);
   self->inBufs->descs[0].memType = XDM_MEMTYPE_RAW;
 
   return TRUE;
 }
 
+/** size of input buffers, big enough for the max resolution, if any */
+static guint
+input_max_size (GstDucatiVidDec * self)
+{
+  return MAX (self->width * self->height, self->max_width * self->max_height);
+}
+
+static void
+input_free (GstDucatiVidDec * self)
+{
+  guint i;
+
+  for (i = 0; i < GST_DUCATIVIDDEC_INPUT_POOLS; i++) {
+    if (self->input_pools[i]) {
+      pool_destroy (self, &self->input_pools[i]);
+    }
+  }
+
+  for (i = 0; i < self->n_inputs; i++) {
+    MemMgr_Free (self->inputs[i]);
+    self->inputs[i] = NULL;
+    self->input_paddrs[i] = 0;
+    self->input_busy[i] = FALSE;
+    if (self->input_bufs[i]) {
+      gst_buffer_unref (self->input_bufs[i]);
+      self->input_bufs[i] = NULL;
+    }
+  }
+
+  self->n_inputs = 0;
+  self->input = NULL;
+}
+
+static gboolean
+input_alloc (GstDucatiVidDec * self)
+{
+  /* there is nothing to overlap with when not threaded: */
+  guint i, n = self->threaded ? self->num_inputs : 1;
+
+  GST_DEBUG_OBJECT (self, "allocating %d input buffers", n);
+
+  for (i = 0; i < n; i++) {
+    self->inputs[i] = gst_ducati_alloc_1d (input_max_size (self));
+    if (G_UNLIKELY (!self->inputs[i])) {
+      GST_ERROR_OBJECT (self, "could not allocate input buffer");
+      input_free (self);
+      return FALSE;
+    }
+    self->input_paddrs[i] = TilerMem_VirtToPhys (self->inputs[i]);
+    self->input_busy[i] = FALSE;
+    self->n_inputs = i + 1;
+  }
+
+  self->next_input = 0;
+
+  /* new input buffers means new codec, so codec_data must be resent: */
+  self->first_in_buffer = TRUE;
+
+  return TRUE;
+}
+
+/** get the index of the input buffer at the given address, or -1 */
+static gint
+input_find (GstDucatiVidDec * self, guint8 * data)
+{
+  guint i;
+
+  for (i = 0; i < self->n_inputs; i++) {
+    if (self->inputs[i] == data) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/** get next input buffer, waiting for the task to finish with it if needed */
+static GstFlowReturn
+input_acquire (GstDucatiVidDec * self, gint * idx)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (G_UNLIKELY (!self->n_inputs) && !input_alloc (self)) {
+    return GST_FLOW_ERROR;
+  }
+
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  while (self->input_busy[self->next_input]) {
+    if (self->srcresult != GST_FLOW_OK) {
+      ret = self->srcresult;
+      break;
+    }
+    GST_LOG_OBJECT (self, "no free input buffer, waiting");
+    GST_DUCATIVIDDEC_QUEUE_WAIT (self);
+  }
+  if (ret == GST_FLOW_OK) {
+    *idx = self->next_input;
+    self->input_busy[*idx] = TRUE;
+    self->next_input = (self->next_input + 1) % self->n_inputs;
+  }
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+
+  return ret;
+}
+
+/** mark input buffer as free, with queue_lock */
+static void
+input_reset (GstDucatiVidDec * self, gint idx)
+{
+  self->input_busy[idx] = FALSE;
+  if (self->input_bufs[idx]) {
+    gst_buffer_unref (self->input_bufs[idx]);
+    self->input_bufs[idx] = NULL;
+  }
+}
+
+static void
+input_release (GstDucatiVidDec * self, gint idx)
+{
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  input_reset (self, idx);
+  GST_DUCATIVIDDEC_QUEUE_SIGNAL (self);
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+}
+
+/** get the physical address of the data in input buffer 'idx' */
+static SSPtr
+input_paddr (GstDucatiVidDec * self, gint idx)
+{
+  if (self->input_bufs[idx]) {
+    return self->input_buf_paddrs[idx];
+  }
+  return self->input_paddrs[idx];
+}
+
+/** copy 'buf' into input buffer 'idx' with the push_input() vmethod,
+ * returning any remaining data
+ */
+static GstBuffer *
+input_stage (GstDucatiVidDec * self, gint idx, GstBuffer * buf)
+{
+  self->input = self->inputs[idx];
+  self->in_size = 0;
+  self->in_buf = NULL;
+
+  buf = GST_DUCATIVIDDEC_GET_CLASS (self)->push_input (self, buf);
+
+  if (self->in_size > 0) {
+    self->first_in_buffer = FALSE;
+  } else if (G_UNLIKELY (buf)) {
+    /* avoid looping forever on the same remaining data: */
+    GST_WARNING_OBJECT (self, "nothing pushed, dropping remaining data");
+    gst_buffer_unref (buf);
+    buf = NULL;
+  }
+
+  /* hold on to input pushed without copying until codec is done with it.
+   * The slot is read by the decoding thread, and input_release() may run
+   * there meanwhile:
+   */
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  self->input_gens[idx] = self->staged_gen;
+  self->input_bufs[idx] = self->in_buf;
+  self->input_buf_paddrs[idx] = self->in_paddr;
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+  self->in_buf = NULL;
+
+  return buf;
+}
+
+/** max number of buffers in the output pool.  In reverse playback, up to
+ * reverse_max_frames decoded buffers are held in self->decoded on top of
+ * what downstream and the codec hold
+ */
+static guint
+pool_max_buffers (GstDucatiVidDec * self)
+{
+  guint max = self->max_output_buffers;
+
+  if (!max) {
+    max = 2 * self->min_buffers;
+  }
+  if (self->reverse) {
+    max += self->reverse_max_frames;
+  }
+
+  return max;
+}
+
 static inline GstBuffer *
 codec_bufferpool_get (GstDucatiVidDec * self, GstBuffer * buf)
 {
+  guint max = pool_max_buffers (self);
+
+  if (G_UNLIKELY (self->old_pools)) {
+    pool_age_out (self, FALSE);
+  }
+
   if (G_UNLIKELY (!self->pool)) {
-    GST_DEBUG_OBJECT (self, "creating bufferpool");
-    self->pool = gst_ducati_bufferpool_new (GST_ELEMENT (self),
-        GST_PAD_CAPS (self->srcpad));
+    GstDucatiBufferPool *pool = pool_reuse (self);
+
+    if (pool) {
+      GST_DEBUG_OBJECT (self, "reusing %dx%d bufferpool",
+          pool->padded_width, pool->padded_height);
+      gst_ducati_bufferpool_set_caps (pool, GST_PAD_CAPS (self->srcpad));
+    } else {
+      GST_DEBUG_OBJECT (self, "creating bufferpool");
+      pool = gst_ducati_bufferpool_new (GST_ELEMENT (self),
+          GST_PAD_CAPS (self->srcpad), self->min_buffers, max);
+    }
+    pool->timeout = self->pool_timeout;
+    pool->idle_timeout = self->pool_idle_timeout;
+    pool->high_water = self->pool_high_water;
+    pool->cache_quota = self->frame_cache_quota;
+    gst_ducati_bufferpool_set_cache_account (pool, self->cache_account);
+
+    GST_OBJECT_LOCK (self);
+    if (self->pool_flushing) {
+      gst_ducati_bufferpool_set_flushing (pool, TRUE);
+    }
+    self->pool = pool;
+    GST_OBJECT_UNLOCK (self);
   }
+
+  /* the limit changes with the playback direction: */
+  self->pool->max_buffers = MAX (max, self->pool->min_buffers);
+
   return GST_BUFFER (gst_ducati_bufferpool_get (self->pool, buf));
 }
 
+/** allocate output buffer from downstream, or fallback to bufferpool */
+static GstBuffer *
+codec_alloc_outbuf (GstDucatiVidDec * self)
+{
+  GstBuffer *outbuf = NULL;
+  GstFlowReturn ret;
+
+  ret = gst_pad_alloc_buffer_and_set_caps (self->srcpad, 0, self->outsize,
+      GST_PAD_CAPS (self->srcpad), &outbuf);
+
+  if (ret != GST_FLOW_OK) {
+    outbuf = codec_bufferpool_get (self, NULL);
+  }
+
+  return outbuf;
+}
+
 static XDAS_Int32
 codec_prepare_outbuf (GstDucatiVidDec * self, GstBuffer * buf)
 {
@@ -202,7 +856,9 @@ codec_prepare_outbuf (GstDucatiVidDec * self, GstBuffer * buf)
 
   if ((y_type < 0) || (uv_type < 0)) {
     GST_DEBUG_OBJECT (self, "non TILER buffer, fallback to bufferpool");
-    return codec_prepare_outbuf (self, codec_bufferpool_get (self, buf));
+    self->n_fallbacks++;
+    buf = codec_bufferpool_get (self, buf);
+    return buf ? codec_prepare_outbuf (self, buf) : 0;
   }
 
   if (!self->outBufs->numBufs) {
@@ -222,36 +878,200 @@ codec_prepare_outbuf (GstDucatiVidDec * self, GstBuffer * buf)
     if ((self->outBufs->descs[0].memType != y_type) ||
         (self->outBufs->descs[1].memType != uv_type)) {
       GST_DEBUG_OBJECT (self, "buffer mismatch, fallback to bufferpool");
-      return codec_prepare_outbuf (self, codec_bufferpool_get (self, buf));
+      self->n_fallbacks++;
+      buf = codec_bufferpool_get (self, buf);
+      return buf ? codec_prepare_outbuf (self, buf) : 0;
     }
   }
 
   self->outBufs->descs[0].buf = (XDAS_Int8 *) y_paddr;
   self->outBufs->descs[1].buf = (XDAS_Int8 *) uv_paddr;
 
-  return (XDAS_Int32) buf;      // XXX use lookup table
+  return outbuf_add (self, buf);
 }
 
 static GstBuffer *
 codec_get_outbuf (GstDucatiVidDec * self, XDAS_Int32 id)
 {
-  GstBuffer *buf = (GstBuffer *) id;    // XXX use lookup table
-  if (buf) {
-    gst_buffer_ref (buf);
+  GstDucatiVidDecOutBuf *slot = outbuf_lookup (self, id);
+  GstClockTime ts;
+
+  if (!slot) {
+    return NULL;
   }
-  return buf;
+
+  /* frames come out in presentation order, so they get the earliest
+   * timestamp of the frames decoded so far, rather than the one of the
+   * input frame that was decoded into this buffer.  Only frames that had a
+   * timestamp put one in the queue, so the others don't take one out:
+   */
+  if (GST_CLOCK_TIME_IS_VALID (slot->ts)) {
+    ts = pts_pop (self);
+    if (GST_CLOCK_TIME_IS_VALID (ts)) {
+      GST_BUFFER_TIMESTAMP (slot->buf) = ts;
+    }
+  }
+  GST_BUFFER_DURATION (slot->buf) = slot->duration;
+  slot->output = TRUE;
+
+  return gst_buffer_ref (slot->buf);
+}
+
+/** whether the codec released output buffer 'id' in the last process() */
+static gboolean
+codec_freed_outbuf (GstDucatiVidDec * self, XDAS_Int32 id)
+{
+  gint i;
+
+  for (i = 0; self->outArgs->freeBufID[i]; i++) {
+    if (self->outArgs->freeBufID[i] == id) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
 }
 
 static void
 codec_unlock_outbuf (GstDucatiVidDec * self, XDAS_Int32 id)
 {
-  GstBuffer *buf = (GstBuffer *) id;    // XXX use lookup table
-  if (buf) {
-    GST_DEBUG_OBJECT (self, "free buffer: %d %p", id, buf);
+  GstDucatiVidDecOutBuf *slot = outbuf_lookup (self, id);
+  if (id == self->pending_id) {
+    self->pending_id = 0;
+  }
+  if (slot) {
+    GstBuffer *buf;
+
+    /* if the frame was never output (ie. skipped), its timestamp won't
+     * be used:
+     */
+    if (!slot->output && GST_CLOCK_TIME_IS_VALID (slot->ts)) {
+      pts_remove (self, slot->ts);
+    }
+
+    buf = outbuf_remove (self, slot);
+    GST_DEBUG_OBJECT (self, "free buffer: %08x %p", id, buf);
     gst_buffer_unref (buf);
   }
 }
 
+static void
+stats_add_process_time (GstDucatiVidDec * self, GstClockTime t)
+{
+  guint bucket = MIN (t / GST_DUCATIVIDDEC_PROCESS_BUCKET_WIDTH,
+      GST_DUCATIVIDDEC_PROCESS_BUCKETS - 1);
+
+  self->n_process++;
+  self->process_time_total += t;
+  self->process_time_min = MIN (self->process_time_min, t);
+  self->process_time_max = MAX (self->process_time_max, t);
+  self->process_hist[bucket]++;
+}
+
+/** estimate the process() time that 'percent' % of calls took at most,
+ * from the histogram
+ */
+static GstClockTime
+stats_process_percentile (GstDucatiVidDec * self, guint n, guint percent)
+{
+  guint64 rank = ((guint64) n * percent + 99) / 100;
+  guint64 count = 0;
+  guint i;
+
+  for (i = 0; i < GST_DUCATIVIDDEC_PROCESS_BUCKETS; i++) {
+    count += self->process_hist[i];
+    if (count >= rank) {
+      break;
+    }
+  }
+
+  /* upper bound of the bucket, but no more than the longest seen: */
+  return MIN ((i + 1) * GST_DUCATIVIDDEC_PROCESS_BUCKET_WIDTH,
+      self->process_time_max);
+}
+
+static GstStructure *
+stats_new (GstDucatiVidDec * self)
+{
+  GstClockTime min = 0, avg = 0, p95 = 0, p99 = 0, lock_avg = 0;
+  guint n = self->n_process;
+  guint hits, misses, i;
+  GList *l;
+
+  if (n) {
+    min = self->process_time_min;
+    avg = self->process_time_total / n;
+    p95 = stats_process_percentile (self, n, 95);
+    p99 = stats_process_percentile (self, n, 99);
+  }
+
+  if (self->lock_count) {
+    lock_avg = self->lock_time_total / self->lock_count;
+  }
+
+  GST_OBJECT_LOCK (self);
+  hits = self->pool_hits;
+  misses = self->pool_misses;
+  if (self->pool) {
+    hits += self->pool->hits;
+    misses += self->pool->misses;
+  }
+  for (l = self->old_pools; l; l = l->next) {
+    GstDucatiBufferPool *pool = l->data;
+    hits += pool->hits;
+    misses += pool->misses;
+  }
+  for (i = 0; i < GST_DUCATIVIDDEC_INPUT_POOLS; i++) {
+    if (self->input_pools[i]) {
+      hits += self->input_pools[i]->hits;
+      misses += self->input_pools[i]->misses;
+    }
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  return gst_structure_new ("ducati-stats",
+      "frames-in", G_TYPE_UINT, self->n_frames_in,
+      "frames-out", G_TYPE_UINT, self->n_frames_out,
+      "process-count", G_TYPE_UINT, n,
+      "process-time-min", G_TYPE_UINT64, min,
+      "process-time-avg", G_TYPE_UINT64, avg,
+      "process-time-p95", G_TYPE_UINT64, p95,
+      "process-time-p99", G_TYPE_UINT64, p99,
+      "process-time-max", G_TYPE_UINT64, self->process_time_max,
+      "bytes-copied", G_TYPE_UINT64, self->bytes_copied,
+      "pool-hits", G_TYPE_UINT, hits,
+      "pool-misses", G_TYPE_UINT, misses,
+      "non-tiler-fallbacks", G_TYPE_UINT, self->n_fallbacks,
+      "errors", G_TYPE_UINT, self->n_errors,
+      "fatal-errors", G_TYPE_UINT, self->n_fatal_errors,
+      "seek-latency", G_TYPE_UINT64, self->seek_latency,
+      "recovery-time", G_TYPE_UINT64, self->recovery_time,
+      "max-locked", G_TYPE_UINT, self->max_locked,
+      "lock-time-avg", G_TYPE_UINT64, lock_avg,
+      "lock-time-max", G_TYPE_UINT64, self->lock_time_max,
+      "accelerator-time", G_TYPE_UINT64, self->sched.busy_time,
+      "accelerator-wait-time", G_TYPE_UINT64, self->sched.wait_time,
+      NULL);
+}
+
+/** post stats as an element message, if stats_interval has passed since
+ * they were last posted
+ */
+static void
+stats_post (GstDucatiVidDec * self)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+
+  if (GST_CLOCK_TIME_IS_VALID (self->stats_time) &&
+      (now - self->stats_time < self->stats_interval * GST_MSECOND)) {
+    return;
+  }
+  self->stats_time = now;
+
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_element (GST_OBJECT (self), stats_new (self)));
+}
+
 static gint
 codec_process (GstDucatiVidDec * self, gboolean send, gboolean flush)
 {
@@ -263,10 +1083,15 @@ codec_process (GstDucatiVidDec * self, gboolean send, gboolean flush)
   self->outArgs->outputID[0] = 0;
   self->outArgs->freeBufID[0] = 0;
 
+  gst_ducati_sched_begin (&self->sched);
   t = gst_util_get_timestamp ();
   err = VIDDEC3_process (self->codec,
       self->inBufs, self->outBufs, self->inArgs, self->outArgs);
-  GST_INFO_OBJECT (self, "%10dns", (gint) (gst_util_get_timestamp () - t));
+  t = gst_util_get_timestamp () - t;
+  GST_INFO_OBJECT (self, "%10dns", (gint) t);
+  gst_ducati_sched_end (&self->sched);
+
+  stats_add_process_time (self, t);
 
   if (err) {
     GST_WARNING_OBJECT (self, "err=%d, extendedError=%08x",
@@ -303,13 +1128,29 @@ codec_process (GstDucatiVidDec * self, gboolean send, gboolean flush)
     }
 
     outbuf = codec_get_outbuf (self, self->outArgs->outputID[i]);
+    if (G_UNLIKELY (!outbuf)) {
+      continue;
+    }
+
+    if (G_UNLIKELY (GST_CLOCK_TIME_IS_VALID (self->flush_time)) && send) {
+      self->seek_latency = gst_util_get_timestamp () - self->flush_time;
+      self->flush_time = GST_CLOCK_TIME_NONE;
+      GST_INFO_OBJECT (self, "seek latency: %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (self->seek_latency));
+    }
+
     if (send) {
       if (GST_IS_DUCATIBUFFER (outbuf)) {
         outbuf = gst_ducati_buffer_get (GST_DUCATIBUFFER (outbuf));
       }
       GST_DEBUG_OBJECT (self, "got buffer: %d %p (%" GST_TIME_FORMAT ")",
           i, outbuf, GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (outbuf)));
-      gst_pad_push (self->srcpad, outbuf);
+      self->n_frames_out++;
+      if (self->reverse_decoding) {
+        self->decoded = g_list_prepend (self->decoded, outbuf);
+      } else {
+        gst_pad_push (self->srcpad, outbuf);
+      }
     } else {
       GST_DEBUG_OBJECT (self, "free buffer: %d %p", i, outbuf);
       gst_buffer_unref (outbuf);
@@ -320,22 +1161,23 @@ codec_process (GstDucatiVidDec * self, gboolean send, gboolean flush)
     codec_unlock_outbuf (self, self->outArgs->freeBufID[i]);
   }
 
+  if (self->stats_interval) {
+    stats_post (self);
+  }
+
   return err;
 }
 
-/** call control(FLUSH), and then process() to pop out all buffers */
+/** call control(FLUSH), and then process() to pop out all buffers.  Caller
+ * must hold the codec lock (or know that nothing else is using the codec)
+ */
 static gboolean
-codec_flush (GstDucatiVidDec * self, gboolean eos)
+codec_drain (GstDucatiVidDec * self, gboolean eos)
 {
   gint err;
 
   GST_DEBUG_OBJECT (self, "flush: eos=%d", eos);
 
-  /* note: flush is synchronized against _chain() to avoid calling
-   * the codec from multiple threads
-   */
-  GST_PAD_STREAM_LOCK (self->sinkpad);
-
   if (G_UNLIKELY (self->first_in_buffer)) {
     return TRUE;
   }
@@ -349,7 +1191,7 @@ codec_flush (GstDucatiVidDec * self, gboolean eos)
       self->dynParams, self->status);
   if (err) {
     GST_ERROR_OBJECT (self, "failed XDM_FLUSH");
-    goto out;
+    return FALSE;
   }
 
   self->inBufs->descs[0].bufSize.bytes = 0;
@@ -360,16 +1202,356 @@ codec_flush (GstDucatiVidDec * self, gboolean eos)
     err = codec_process (self, eos, TRUE);
   } while (err != XDM_EFAIL);
 
+  /* the codec does not hold on to any output buffer after a flush: */
+  self->pending_id = 0;
+  self->n_pts = 0;
+
   /* on a flush, it is normal (and not an error) for the last _process() call
    * to return an error..
    */
-  err = XDM_EOK;
+  return TRUE;
+}
+
+static gboolean
+codec_flush (GstDucatiVidDec * self, gboolean eos)
+{
+  gboolean ret;
+
+  /* note: flush is synchronized against _chain() (or the task, in threaded
+   * mode) to avoid calling the codec from multiple threads
+   */
+  GST_DUCATIVIDDEC_CODEC_LOCK (self);
+  ret = codec_drain (self, eos);
+  GST_DUCATIVIDDEC_CODEC_UNLOCK (self);
 
-out:
-  GST_PAD_STREAM_UNLOCK (self->sinkpad);
   GST_DEBUG_OBJECT (self, "done");
 
-  return !err;
+  return ret;
+}
+
+/** discard everything the codec holds without decoding it, for seeks and
+ * error recovery.  The caller must own the codec (see codec_discard())
+ */
+static gboolean
+codec_reset (GstDucatiVidDec * self)
+{
+  gint err;
+
+  GST_DEBUG_OBJECT (self, "reset");
+
+  if (G_UNLIKELY (self->first_in_buffer) || G_UNLIKELY (!self->codec)) {
+    return TRUE;
+  }
+
+  err = VIDDEC3_control (self->codec, XDM_RESET,
+      self->dynParams, self->status);
+  if (err) {
+    GST_WARNING_OBJECT (self, "failed XDM_RESET, flushing instead");
+    return codec_drain (self, FALSE);
+  }
+
+  /* after a reset, the codec has forgotten about all the buffers it had
+   * locked, so release them all like it had returned them in freeBufID:
+   */
+  outbuf_reset (self);
+  self->pending_id = 0;
+
+  /* and needs codec_data again, which the staging thread sends: */
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  self->codec_gen++;
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+
+  return TRUE;
+}
+
+/** from the decoding thread, have the staging thread drop input until the
+ * next keyframe
+ */
+static void
+codec_request_resync (GstDucatiVidDec * self)
+{
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  self->resync = TRUE;
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+}
+
+/** on the staging thread, act on what the decoding thread asked for */
+static void
+input_resync (GstDucatiVidDec * self)
+{
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  if (G_UNLIKELY (self->resync)) {
+    self->resync = FALSE;
+    self->wait_keyframe = TRUE;
+  }
+  if (G_UNLIKELY (self->staged_gen != self->codec_gen)) {
+    self->staged_gen = self->codec_gen;
+    self->first_in_buffer = TRUE;
+  }
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+}
+
+/** codec_reset(), synchronized against _chain() (or the task, in threaded
+ * mode) like codec_flush()
+ */
+static gboolean
+codec_discard (GstDucatiVidDec * self)
+{
+  gboolean ret;
+
+  GST_DUCATIVIDDEC_CODEC_LOCK (self);
+  ret = codec_reset (self);
+  GST_DUCATIVIDDEC_CODEC_UNLOCK (self);
+
+  return ret;
+}
+
+/** switch the codec to a new resolution without re-creating it, which is
+ * possible if it was created with a big enough maxWidth/maxHeight.  Like
+ * codec_drain(), nothing else may be using the codec
+ */
+static gboolean
+codec_reconfigure (GstDucatiVidDec * self)
+{
+  gint err;
+
+  GST_DEBUG_OBJECT (self, "reconfiguring codec");
+
+  /* push out anything still decoded at the old resolution: */
+  if (!codec_drain (self, TRUE)) {
+    return FALSE;
+  }
+
+  /* output buffers are a different size now, so let the bufferpool be
+   * re-created and re-initialize outBufs on the next output buffer:
+   */
+  outbuf_reset (self);
+  if (self->pool) {
+    pool_retire (self);
+    pool_age_out (self, FALSE);
+  }
+  self->outBufs->numBufs = 0;
+
+  err = VIDDEC3_control (self->codec, XDM_SETPARAMS,
+      self->dynParams, self->status);
+  if (err) {
+    GST_ERROR_OBJECT (self, "failed XDM_SETPARAMS");
+    return FALSE;
+  }
+
+  /* crop info and codec_data need to be sent again: */
+  self->first_out_buffer = TRUE;
+  self->first_in_buffer = TRUE;
+
+  return TRUE;
+}
+
+/* queue/task used in threaded mode */
+
+/** free a queued item, with queue_lock */
+static void
+queue_item_free (GstDucatiVidDec * self, GstMiniObject * obj)
+{
+  if (GST_IS_BUFFER (obj)) {
+    gint idx = input_find (self, GST_BUFFER_DATA (obj));
+    if (idx >= 0) {
+      input_reset (self, idx);
+    }
+  }
+  gst_mini_object_unref (obj);
+}
+
+/** queue a buffer or serialized event for the task, blocking if full */
+static GstFlowReturn
+queue_push (GstDucatiVidDec * self, GstMiniObject * obj)
+{
+  GstFlowReturn ret;
+
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  while ((self->srcresult == GST_FLOW_OK) &&
+      (g_queue_get_length (self->queue) >= self->queue_size)) {
+    GST_LOG_OBJECT (self, "queue full, waiting");
+    GST_DUCATIVIDDEC_QUEUE_WAIT (self);
+  }
+
+  ret = self->srcresult;
+  if (G_LIKELY (ret == GST_FLOW_OK)) {
+    g_queue_push_tail (self->queue, obj);
+  } else {
+    GST_DEBUG_OBJECT (self, "dropping %" GST_PTR_FORMAT ", reason %s",
+        obj, gst_flow_get_name (ret));
+    queue_item_free (self, obj);
+  }
+  GST_DUCATIVIDDEC_QUEUE_SIGNAL (self);
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+
+  return ret;
+}
+
+/** discard anything queued, and set the result returned to _chain() */
+static void
+queue_flush (GstDucatiVidDec * self, GstFlowReturn srcresult)
+{
+  GstMiniObject *obj;
+
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  self->srcresult = srcresult;
+  while ((obj = g_queue_pop_head (self->queue))) {
+    queue_item_free (self, obj);
+  }
+  if (srcresult == GST_FLOW_OK) {
+    guint i;
+    /* the task is not running when (re)started, so any input buffer it
+     * was holding on to when it stopped is free now:
+     */
+    for (i = 0; i < self->n_inputs; i++) {
+      input_reset (self, i);
+    }
+  }
+  GST_DUCATIVIDDEC_QUEUE_SIGNAL (self);
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+}
+
+/** copy input into a free input buffer and queue that for the task */
+static GstFlowReturn
+queue_push_input (GstDucatiVidDec * self, GstBuffer * buf)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBuffer *staged;
+  gint idx;
+
+  /* push_input() may return a sub-buffer of remaining data, which goes
+   * in the next input buffer:
+   */
+  while (buf && (ret == GST_FLOW_OK)) {
+    ret = input_acquire (self, &idx);
+    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+      break;
+    }
+
+    staged = gst_buffer_new ();
+    gst_buffer_copy_metadata (staged, buf,
+        GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS);
+
+    buf = input_stage (self, idx, buf);
+
+    if (self->in_size == 0) {
+      GST_DEBUG_OBJECT (self, "no input, skipping");
+      input_release (self, idx);
+      gst_buffer_unref (staged);
+      continue;
+    }
+
+    /* the queued buffer just points at the input buffer, even if the data
+     * was not copied there, so the task can find it:
+     */
+    GST_BUFFER_DATA (staged) = self->inputs[idx];
+    GST_BUFFER_SIZE (staged) = self->in_size;
+
+    ret = queue_push (self, GST_MINI_OBJECT (staged));
+  }
+
+  if (buf) {
+    gst_buffer_unref (buf);
+  }
+
+  return ret;
+}
+
+/** wait until the task has processed everything that is queued */
+static void
+queue_wait_idle (GstDucatiVidDec * self)
+{
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  while ((self->srcresult == GST_FLOW_OK) &&
+      (self->busy || !g_queue_is_empty (self->queue))) {
+    GST_DUCATIVIDDEC_QUEUE_WAIT (self);
+  }
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+}
+
+static GstFlowReturn gst_ducati_viddec_decode (GstDucatiVidDec * self,
+    GstBuffer * buf);
+static gboolean gst_ducati_viddec_handle_event (GstDucatiVidDec * self,
+    GstEvent * event);
+
+static void
+gst_ducati_viddec_loop (GstDucatiVidDec * self)
+{
+  GstMiniObject *obj;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  while ((self->srcresult == GST_FLOW_OK) && g_queue_is_empty (self->queue)) {
+    GST_DUCATIVIDDEC_QUEUE_WAIT (self);
+  }
+  if (self->srcresult != GST_FLOW_OK) {
+    GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+    goto pause;
+  }
+  obj = g_queue_pop_head (self->queue);
+  self->busy = TRUE;
+  GST_DUCATIVIDDEC_QUEUE_SIGNAL (self);
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+
+  if (GST_IS_BUFFER (obj)) {
+    ret = gst_ducati_viddec_decode (self, GST_BUFFER (obj));
+  } else {
+    GstEvent *event = GST_EVENT (obj);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_EOS) {
+      ret = GST_FLOW_UNEXPECTED;
+    }
+    gst_ducati_viddec_handle_event (self, event);
+  }
+
+  GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+  self->busy = FALSE;
+  if (G_UNLIKELY (ret != GST_FLOW_OK) && (self->srcresult == GST_FLOW_OK)) {
+    self->srcresult = ret;
+  }
+  GST_DUCATIVIDDEC_QUEUE_SIGNAL (self);
+  GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+
+  /* errors are posted where they happen (see codec_recover()), and the
+   * flow return is passed on to upstream by the next _chain(), like in
+   * non-threaded mode:
+   */
+  if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+    GST_DEBUG_OBJECT (self, "decode returned %s", gst_flow_get_name (ret));
+    goto pause;
+  }
+
+  return;
+
+pause:
+  GST_DEBUG_OBJECT (self, "pausing task");
+  gst_pad_pause_task (self->srcpad);
+}
+
+static gboolean
+gst_ducati_viddec_src_activate_push (GstPad * pad, gboolean active)
+{
+  GstDucatiVidDec *self = GST_DUCATIVIDDEC (GST_OBJECT_PARENT (pad));
+  gboolean ret = TRUE;
+
+  if (!self->threaded) {
+    return TRUE;
+  }
+
+  if (active) {
+    GST_DEBUG_OBJECT (self, "starting task");
+    queue_flush (self, GST_FLOW_OK);
+    ret = gst_pad_start_task (pad,
+        (GstTaskFunction) gst_ducati_viddec_loop, self);
+  } else {
+    /* unblock the task and _chain() before stopping: */
+    GST_DEBUG_OBJECT (self, "stopping task");
+    queue_flush (self, GST_FLOW_WRONG_STATE);
+    ret = gst_pad_stop_task (pad);
+    queue_flush (self, GST_FLOW_WRONG_STATE);
+  }
+
+  return ret;
 }
 
 /* GstDucatiVidDec vmethod default implementations */
@@ -387,11 +1569,18 @@ gst_ducati_viddec_parse_caps (GstDucatiVidDec * self, GstStructure * s)
     w = ALIGN2 (w, 4);                 /* round up to MB */
 
     /* if we've already created codec, but the resolution has changed, we
-     * need to re-create the codec:
+     * need to re-create the codec, unless it was created for a max
+     * resolution that the new one fits in:
      */
     if (G_UNLIKELY (self->codec)) {
       if ((h != self->height) || (w != self->width)) {
-        codec_delete (self);
+        gboolean fits = self->max_width && self->max_height &&
+            (w <= self->params->maxWidth) && (h <= self->params->maxHeight);
+        if (!fits || !codec_reconfigure (self)) {
+          codec_delete (self);
+          pool_age_out (self, FALSE);
+          input_free (self);
+        }
       }
     }
 
@@ -400,6 +1589,11 @@ gst_ducati_viddec_parse_caps (GstDucatiVidDec * self, GstStructure * s)
 
     codec_data = gst_structure_get_value (s, "codec_data");
 
+    if (self->codec_data) {
+      gst_buffer_unref (self->codec_data);
+      self->codec_data = NULL;
+    }
+
     if (codec_data) {
       GstBuffer *buffer = gst_value_get_buffer (codec_data);
       GST_DEBUG_OBJECT (self, "codec_data: %" GST_PTR_FORMAT, buffer);
@@ -478,190 +1672,816 @@ gst_ducati_viddec_allocate_params (GstDucatiVidDec * self, gint params_sz,
   return TRUE;
 }
 
-static GstBuffer *
-gst_ducati_viddec_push_input (GstDucatiVidDec * self, GstBuffer * buf)
+static GstBuffer *
+gst_ducati_viddec_push_input (GstDucatiVidDec * self, GstBuffer * buf)
+{
+  if (G_UNLIKELY (self->first_in_buffer) && self->codec_data) {
+    push_input (self, GST_BUFFER_DATA (self->codec_data),
+        GST_BUFFER_SIZE (self->codec_data));
+  }
+
+  /* just pass entire buffer, without copying if possible */
+  push_input_buffer (self, buf);
+  gst_buffer_unref (buf);
+
+  return NULL;
+}
+
+static gboolean
+gst_ducati_viddec_is_sync_point (GstDucatiVidDec * self, GstBuffer * buf)
+{
+  return !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+/* GstElement vmethod implementations */
+
+static gboolean
+gst_ducati_viddec_set_caps (GstPad * pad, GstCaps * caps)
+{
+  gboolean ret = TRUE;
+  GstDucatiVidDec *self = GST_DUCATIVIDDEC (gst_pad_get_parent (pad));
+  GstDucatiVidDecClass *klass = GST_DUCATIVIDDEC_GET_CLASS (self);
+  GstStructure *s;
+
+  g_return_val_if_fail (caps, FALSE);
+  g_return_val_if_fail (gst_caps_is_fixed (caps), FALSE);
+
+  s = gst_caps_get_structure (caps, 0);
+
+  if (pad == self->sinkpad) {
+    gint frn = 0, frd = 1;
+    GST_INFO_OBJECT (self, "setcaps (sink): %" GST_PTR_FORMAT, caps);
+
+    /* previously queued buffers must be decoded with the old caps, and
+     * the codec may be re-created below:
+     */
+    if (self->threaded) {
+      queue_wait_idle (self);
+    }
+
+    if (klass->parse_caps (self, s)) {
+      GstCaps *outcaps;
+      gboolean interlaced = FALSE;
+
+      gst_structure_get_fraction (s, "framerate", &frn, &frd);
+
+      self->fps_n = frn;
+      self->fps_d = frd;
+
+      self->stride = 4096;      /* TODO: don't hardcode */
+
+      gst_structure_get_boolean (s, "interlaced", &interlaced);
+
+      /* update output/padded sizes:
+       */
+      klass->update_buffer_size (self);
+
+      self->outsize =
+          GST_ROUND_UP_2 (self->stride * self->padded_height * 3) / 2;
+
+      outcaps = gst_caps_new_simple ("video/x-raw-yuv-strided",
+          "rowstride", G_TYPE_INT, self->stride,
+          "format", GST_TYPE_FOURCC, GST_MAKE_FOURCC ('N','V','1','2'),
+          "width", G_TYPE_INT, self->padded_width,
+          "height", G_TYPE_INT, self->padded_height,
+          "framerate", GST_TYPE_FRACTION, frn, frd,
+          NULL);
+
+      if (interlaced) {
+        gst_caps_set_simple (outcaps, "interlaced", G_TYPE_BOOLEAN, TRUE, NULL);
+      }
+
+      GST_DEBUG_OBJECT (self, "outcaps: %" GST_PTR_FORMAT, outcaps);
+
+      ret = gst_pad_set_caps (self->srcpad, outcaps);
+      gst_caps_unref (outcaps);
+
+      if (!ret) {
+        GST_WARNING_OBJECT (self, "failed to set caps");
+        return FALSE;
+      }
+    } else {
+      GST_WARNING_OBJECT (self, "missing required fields");
+      return FALSE;
+    }
+  } else {
+    GST_INFO_OBJECT (self, "setcaps (src): %" GST_PTR_FORMAT, caps);
+    // XXX check to make sure caps are ok.. keep track if we
+    // XXX need to handle unstrided buffers..
+    GST_WARNING_OBJECT (self, "TODO");
+  }
+
+  gst_object_unref (self);
+
+  return gst_pad_set_caps (pad, caps);
+}
+
+static GstFlowReturn
+gst_ducati_viddec_buffer_alloc (GstPad * pad, guint64 offset, guint size,
+    GstCaps * caps, GstBuffer ** buf)
+{
+  GstDucatiVidDec *self = GST_DUCATIVIDDEC (GST_OBJECT_PARENT (pad));
+  GstDucatiVidDecClass *klass = GST_DUCATIVIDDEC_GET_CLASS (self);
+  guint max_size = input_max_size (self);
+  guint pool_size = GST_DUCATIVIDDEC_MIN_INPUT_POOL_SIZE;
+  GstDucatiBufferPool *pool;
+  gint i;
+
+  /* if we don't return a buffer, a normal one is allocated instead: */
+  *buf = NULL;
+
+  /* in case downstream provides the output buffers, so old output pools
+   * aren't aged out when getting one from our pool:
+   */
+  if (G_UNLIKELY (self->old_pools)) {
+    pool_age_out (self, FALSE);
+  }
+
+  /* we don't know how big the input can get until caps are set: */
+  if (!GST_PAD_CAPS (pad) || !gst_caps_is_equal (caps, GST_PAD_CAPS (pad))) {
+    GST_DEBUG_OBJECT (self, "caps not negotiated yet");
+    return GST_FLOW_OK;
+  }
+
+  if (size > max_size) {
+    GST_DEBUG_OBJECT (self, "input buffer too big: %d", size);
+    return GST_FLOW_OK;
+  }
+
+  /* pick the smallest size class the buffer fits in, the last one being
+   * the max input size:
+   */
+  for (i = 0; (i < GST_DUCATIVIDDEC_INPUT_POOLS - 1) &&
+      (pool_size < MIN (size, max_size)); i++) {
+    pool_size *= 2;
+  }
+  pool_size = (i == GST_DUCATIVIDDEC_INPUT_POOLS - 1) ? max_size :
+      MIN (pool_size, max_size);
+
+  if (G_UNLIKELY (self->input_pools[i]) &&
+      (!gst_caps_is_equal (caps, self->input_pools[i]->caps) ||
+          (self->input_pools[i]->size != pool_size))) {
+    pool_destroy (self, &self->input_pools[i]);
+  }
+
+  if (G_UNLIKELY (!self->input_pools[i])) {
+    GST_DEBUG_OBJECT (self, "creating input bufferpool of %u byte buffers",
+        pool_size);
+    pool = gst_ducati_bufferpool_new_1d (GST_ELEMENT (self),
+        caps, pool_size, klass->input_headroom);
+    pool->max_buffers = GST_DUCATIVIDDEC_MAX_INPUT_POOL_BUFFERS;
+    pool->idle_timeout = self->pool_idle_timeout;
+    pool->high_water = self->pool_high_water;
+    pool->cache_quota = self->frame_cache_quota;
+    gst_ducati_bufferpool_set_cache_account (pool, self->cache_account);
+    self->input_pools[i] = pool;
+  }
+
+  /* rather than making upstream wait for one of ours: */
+  *buf = GST_BUFFER (gst_ducati_bufferpool_try_get (self->input_pools[i],
+          NULL));
+  if (*buf) {
+    GST_BUFFER_SIZE (*buf) = size;
+    GST_BUFFER_OFFSET (*buf) = offset;
+  }
+
+  return GST_FLOW_OK;
+}
+
+/** update the codec frame skip mode if QoS events called for it */
+static void
+codec_update_skip (GstDucatiVidDec * self)
+{
+  gint level;
+  gint err;
+
+  GST_OBJECT_LOCK (self);
+  level = self->qos_level;
+  GST_OBJECT_UNLOCK (self);
+
+  /* in trick mode, only I frames get this far anyway: */
+  if (self->keyframes_only) {
+    level = G_N_ELEMENTS (skip_modes) - 1;
+  }
+
+  if (G_LIKELY (level == self->skip_level)) {
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "frame skip level: %d -> %d",
+      self->skip_level, level);
+
+  self->dynParams->frameSkipMode = skip_modes[level];
+  err = VIDDEC3_control (self->codec, XDM_SETPARAMS,
+      self->dynParams, self->status);
+  if (err) {
+    GST_WARNING_OBJECT (self, "failed XDM_SETPARAMS");
+  }
+
+  self->skip_level = level;
+}
+
+static void
+qos_reset (GstDucatiVidDec * self)
+{
+  GST_OBJECT_LOCK (self);
+  self->qos_late = 0;
+  self->qos_early = 0;
+  self->qos_level = 0;
+  GST_OBJECT_UNLOCK (self);
+}
+
+static gboolean
+gst_ducati_viddec_src_event (GstPad * pad, GstEvent * event)
+{
+  GstDucatiVidDec *self = GST_DUCATIVIDDEC (GST_OBJECT_PARENT (pad));
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_QOS) {
+    gdouble proportion;
+    GstClockTimeDiff diff;
+    GstClockTime timestamp;
+
+    gst_event_parse_qos (event, &proportion, &diff, &timestamp);
+
+    /* decode less when we keep being late, and step back down once we
+     * have been on time for a while:
+     */
+    GST_OBJECT_LOCK (self);
+    if (diff > 0) {
+      self->qos_early = 0;
+      if ((++self->qos_late >= QOS_LATE_COUNT) &&
+          (self->qos_level < G_N_ELEMENTS (skip_modes) - 1)) {
+        self->qos_level++;
+        self->qos_late = 0;
+      }
+    } else {
+      self->qos_late = 0;
+      if ((++self->qos_early >= QOS_EARLY_COUNT) && (self->qos_level > 0)) {
+        self->qos_level--;
+        self->qos_early = 0;
+      }
+    }
+    GST_OBJECT_UNLOCK (self);
+
+    GST_LOG_OBJECT (self, "QoS: proportion=%g, diff=%" G_GINT64_FORMAT
+        ", level=%d", proportion, diff, self->qos_level);
+  } else if (GST_EVENT_TYPE (event) == GST_EVENT_SEEK) {
+    GstSeekFlags flags;
+
+    gst_event_parse_seek (event, NULL, NULL, &flags, NULL, NULL, NULL, NULL);
+
+    GST_OBJECT_LOCK (self);
+    self->seek_skip = !!(flags & GST_SEEK_FLAG_SKIP);
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  return gst_pad_push_event (self->sinkpad, event);
+}
+
+/** latency added by the codec holding back frames for display */
+static GstClockTime
+codec_latency (GstDucatiVidDec * self)
+{
+  gint frames;
+
+  if (!self->params || !self->fps_n) {
+    return 0;
+  }
+
+  frames = self->params->displayDelay;
+  if (frames == IVIDDEC3_DISPLAY_DELAY_AUTO) {
+    frames = self->max_display_delay;
+  }
+
+  return gst_util_uint64_scale (frames, GST_SECOND * self->fps_d,
+      self->fps_n);
+}
+
+static gboolean
+gst_ducati_viddec_query (GstPad * pad, GstQuery * query)
+{
+  GstDucatiVidDec *self = GST_DUCATIVIDDEC (GST_OBJECT_PARENT (pad));
+
+  GST_DEBUG_OBJECT (self, "query: %"GST_PTR_FORMAT, query);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_LATENCY: {
+      gboolean live;
+      GstClockTime min, max, latency;
+
+      if (!gst_pad_peer_query (self->sinkpad, query)) {
+        return FALSE;
+      }
+
+      gst_query_parse_latency (query, &live, &min, &max);
+
+      latency = codec_latency (self);
+      GST_DEBUG_OBJECT (self, "codec latency: %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (latency));
+
+      min += latency;
+      if (GST_CLOCK_TIME_IS_VALID (max)) {
+        max += latency;
+      }
+
+      gst_query_set_latency (query, live, min, max);
+      return TRUE;
+    }
+    case GST_QUERY_BUFFERS:
+      GST_DEBUG_OBJECT (self, "min buffers: %d", self->min_buffers);
+      gst_query_set_buffers_count (query, self->min_buffers);
+
+      GST_DEBUG_OBJECT (self, "min dimensions: %dx%d",
+          self->padded_width, self->padded_height);
+      gst_query_set_buffers_dimensions (query,
+          self->padded_width, self->padded_height);
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/** handle a decode error by dropping input until the next keyframe, unless
+ * there have been too many fatal errors in a row
+ */
+static GstFlowReturn
+codec_recover (GstDucatiVidDec * self, gboolean fatal)
+{
+  XDAS_Int32 ext = self->outArgs->extendedError;
+
+  self->n_errors++;
+  if (fatal) {
+    self->n_fatal_errors++;
+    self->consecutive_errors++;
+  }
+
+  GST_WARNING_OBJECT (self, "decode error: %08x%s%s, waiting for keyframe",
+      ext, fatal ? " (fatal)" : "",
+      XDM_ISCORRUPTEDDATA (ext) ? " (corrupted data)" : "");
+
+  if (fatal && (self->consecutive_errors > self->max_errors)) {
+    GST_ELEMENT_ERROR (self, STREAM, DECODE, (NULL),
+        ("%d decode errors in a row, last: %08x",
+            self->consecutive_errors, ext));
+    return GST_FLOW_ERROR;
+  }
+
+  /* after a fatal error, start again from a clean state.  We are already
+   * decoding, so whatever thread we are on owns the codec (which in
+   * threaded mode is not necessarily the task, for ex. in reverse_flush()):
+   */
+  if (fatal) {
+    codec_reset (self);
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (self->error_time)) {
+    self->error_time = gst_util_get_timestamp ();
+  }
+  self->skip_to_keyframe = TRUE;
+  codec_request_resync (self);
+
+  return GST_FLOW_OK;
+}
+
+/** decode the first frame in 'buf' (which may already have been copied to
+ * an input buffer by queue_push_input()), leaving any remaining data that
+ * push_input() did not consume in 'buf'
+ */
+static GstFlowReturn
+gst_ducati_viddec_decode_frame (GstDucatiVidDec * self, GstBuffer ** pbuf)
+{
+  GstBuffer *buf = *pbuf;
+  GstClockTime ts = GST_BUFFER_TIMESTAMP (buf);
+  GstClockTime duration = GST_BUFFER_DURATION (buf);
+  GstFlowReturn ret;
+  Int32 err;
+  GstBuffer *outbuf = NULL;
+  gint idx, size, offset = 0;
+  gboolean sync = !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  /* after an error, drop anything already queued up until a keyframe: */
+  if (G_UNLIKELY (self->skip_to_keyframe)) {
+    GstBuffer *data = buf;
+
+    /* if the input was queued without copying, check the original: */
+    idx = input_find (self, GST_BUFFER_DATA (buf));
+    if ((idx >= 0) && self->input_bufs[idx]) {
+      data = self->input_bufs[idx];
+    }
+
+    sync = GST_DUCATIVIDDEC_GET_CLASS (self)->is_sync_point (self, data);
+    if (!sync) {
+      GST_LOG_OBJECT (self, "waiting for keyframe, dropping delta unit");
+      if (idx >= 0) {
+        input_release (self, idx);
+      }
+      gst_buffer_unref (buf);
+      *pbuf = NULL;
+      return GST_FLOW_OK;
+    }
+    self->skip_to_keyframe = FALSE;
+  }
+
+  /* do this before creating codec to ensure reverse caps negotiation
+   * happens first:
+   */
+  if (!self->pending_id) {
+    outbuf = codec_alloc_outbuf (self);
+  }
+
+  if (G_UNLIKELY (!self->codec)) {
+    if (!codec_create (self)) {
+      GST_ERROR_OBJECT (self, "could not create codec");
+      if (outbuf) {
+        gst_buffer_unref (outbuf);
+      }
+      return GST_FLOW_ERROR;
+    }
+  }
+
+  /* note: in threaded mode, the sink thread is staging the next input in
+   * self->in_size meanwhile, so the size of this one is kept locally:
+   */
+  idx = input_find (self, GST_BUFFER_DATA (buf));
+  if (idx >= 0) {
+    /* already copied to an input buffer by queue_push_input(): */
+    size = GST_BUFFER_SIZE (buf);
+    gst_buffer_unref (buf);
+    *pbuf = NULL;
+  } else {
+    ret = input_acquire (self, &idx);
+    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+      GST_ERROR_OBJECT (self, "could not get input buffer");
+      if (outbuf) {
+        gst_buffer_unref (outbuf);
+      }
+      return ret;
+    }
+    *pbuf = input_stage (self, idx, buf);
+    size = self->in_size;
+  }
+
+  if (size == 0) {
+    GST_DEBUG_OBJECT (self, "no input, skipping process");
+    input_release (self, idx);
+    if (outbuf) {
+      gst_buffer_unref (outbuf);
+    }
+    return GST_FLOW_OK;
+  }
+
+  /* staged before the codec was reset, so without codec_data: */
+  if (G_UNLIKELY (self->input_gens[idx] != self->codec_gen)) {
+    GST_DEBUG_OBJECT (self, "dropping input staged before codec reset");
+    input_release (self, idx);
+    if (outbuf) {
+      gst_buffer_unref (outbuf);
+    }
+    return GST_FLOW_OK;
+  }
+
+  /* if the input contains more than one frame, the codec only consumes
+   * the first one, so keep going with a new output buffer until all of
+   * the input is used:
+   */
+  do {
+    if (self->pending_id) {
+      /* codec is still decoding into the previous output buffer (and
+       * outBufs still points at it), so give it the same one again:
+       */
+      GST_DEBUG_OBJECT (self, "reusing pending output buffer: %d",
+          self->pending_id);
+      self->inArgs->inputID = self->pending_id;
+      if (outbuf) {
+        gst_buffer_unref (outbuf);
+        outbuf = NULL;
+      }
+    } else {
+      if (!outbuf) {
+        GST_DEBUG_OBJECT (self, "%d bytes left", size - offset);
+        outbuf = codec_alloc_outbuf (self);
+        ts = duration = GST_CLOCK_TIME_NONE;
+      }
+
+      if (G_UNLIKELY (!outbuf)) {
+        input_release (self, idx);
+        if (self->pool_flushing) {
+          GST_DEBUG_OBJECT (self, "flushing, no output buffer");
+          return GST_FLOW_WRONG_STATE;
+        }
+        GST_ERROR_OBJECT (self, "could not allocate output buffer");
+        return GST_FLOW_ERROR;
+      }
+
+      GST_BUFFER_TIMESTAMP (outbuf) = ts;
+      GST_BUFFER_DURATION (outbuf) = duration;
+
+      /* pass new output buffer as to the decoder to decode into: */
+      self->inArgs->inputID = codec_prepare_outbuf (self, outbuf);
+      outbuf = NULL;
+      if (!self->inArgs->inputID) {
+        input_release (self, idx);
+        if (self->pool_flushing) {
+          return GST_FLOW_WRONG_STATE;
+        }
+        GST_ERROR_OBJECT (self, "could not prepare output buffer");
+        return GST_FLOW_ERROR;
+      }
+    }
+
+    codec_update_skip (self);
+
+    self->inArgs->numBytes = size - offset;
+    self->inBufs->descs[0].buf =
+        (XDAS_Int8 *) (input_paddr (self, idx) + offset);
+    self->inBufs->descs[0].bufSize.bytes = size - offset;
+
+    err = codec_process (self, TRUE, FALSE);
+    if (err && (offset > 0)) {
+      /* probably just padding after the last frame: */
+      GST_WARNING_OBJECT (self, "dropping %d trailing bytes: %d %08x",
+          size - offset, err, self->outArgs->extendedError);
+      /* the codec won't decode into the output buffer it was given for
+       * them, so unlock it, unless it still holds on to it:
+       */
+      if (self->outArgs->outBufsInUseFlag) {
+        self->pending_id = self->inArgs->inputID;
+      } else if (!codec_freed_outbuf (self, self->inArgs->inputID)) {
+        codec_unlock_outbuf (self, self->inArgs->inputID);
+      }
+      break;
+    } else if (err || XDM_ISCORRUPTEDDATA (self->outArgs->extendedError)) {
+      input_release (self, idx);
+      return codec_recover (self, !!err);
+    }
+
+    /* if the codec did not finish with the output buffer (no complete
+     * frame yet), keep it for the next call rather than allocating another
+     * one.  Note that codec_process() clears pending_id if the buffer was
+     * already freed:
+     */
+    if (self->outArgs->outBufsInUseFlag) {
+      self->pending_id = self->inArgs->inputID;
+    } else {
+      self->pending_id = 0;
+    }
+
+    offset += self->outArgs->bytesConsumed;
+  } while ((self->outArgs->bytesConsumed > 0) && (offset < size));
+
+  input_release (self, idx);
+
+  /* the first keyframe after an error decoded fine: */
+  if (G_UNLIKELY (GST_CLOCK_TIME_IS_VALID (self->error_time)) && sync) {
+    self->recovery_time = gst_util_get_timestamp () - self->error_time;
+    self->error_time = GST_CLOCK_TIME_NONE;
+    self->consecutive_errors = 0;
+    GST_INFO_OBJECT (self, "recovered from error in %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (self->recovery_time));
+  }
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_ducati_viddec_decode (GstDucatiVidDec * self, GstBuffer * buf)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (G_UNLIKELY (!self->engine)) {
+    GST_ERROR_OBJECT (self, "no engine");
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+
+  /* push_input() may return a sub-buffer of remaining data, for ex. if
+   * there is more than one frame in the buffer:
+   */
+  while (buf && (ret == GST_FLOW_OK)) {
+    ret = gst_ducati_viddec_decode_frame (self, &buf);
+  }
+
+  if (buf) {
+    gst_buffer_unref (buf);
+  }
+
+  return ret;
+}
+
+/* reverse playback */
+
+static void
+buffer_list_free (GList * list)
 {
-  if (G_UNLIKELY (self->first_in_buffer) && self->codec_data) {
-    push_input (self, GST_BUFFER_DATA (self->codec_data),
-        GST_BUFFER_SIZE (self->codec_data));
-  }
+  GList *l;
 
-  /* just copy entire buffer */
-  push_input (self, GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
-  gst_buffer_unref (buf);
+  for (l = list; l; l = l->next) {
+    if (l->data) {
+      gst_buffer_unref (l->data);
+    }
+  }
 
-  return NULL;
+  g_list_free (list);
 }
 
-/* GstElement vmethod implementations */
-
-static gboolean
-gst_ducati_viddec_set_caps (GstPad * pad, GstCaps * caps)
+static void
+reverse_clear (GstDucatiVidDec * self)
 {
-  gboolean ret = TRUE;
-  GstDucatiVidDec *self = GST_DUCATIVIDDEC (gst_pad_get_parent (pad));
-  GstDucatiVidDecClass *klass = GST_DUCATIVIDDEC_GET_CLASS (self);
-  GstStructure *s;
+  buffer_list_free (self->gather);
+  self->gather = NULL;
+  self->n_gather = 0;
 
-  g_return_val_if_fail (caps, FALSE);
-  g_return_val_if_fail (gst_caps_is_fixed (caps), FALSE);
+  buffer_list_free (self->decoded);
+  self->decoded = NULL;
 
-  s = gst_caps_get_structure (caps, 0);
+  self->gop_too_long = FALSE;
+}
 
-  if (pad == self->sinkpad) {
-    gint frn = 0, frd = 1;
-    GST_INFO_OBJECT (self, "setcaps (sink): %" GST_PTR_FORMAT, caps);
+/** decode the gathered GOP, and push the decoded frames in reverse order */
+static GstFlowReturn
+reverse_flush (GstDucatiVidDec * self)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  gboolean discont = TRUE;
+  GList *l;
 
-    if (klass->parse_caps (self, s)) {
-      GstCaps *outcaps;
-      gboolean interlaced = FALSE;
+  if (!self->gather) {
+    return GST_FLOW_OK;
+  }
 
-      gst_structure_get_fraction (s, "framerate", &frn, &frd);
+  GST_DEBUG_OBJECT (self, "decoding GOP of %d frames", self->n_gather);
 
-      self->stride = 4096;      /* TODO: don't hardcode */
+  /* in threaded mode, the GOP is decoded from here once the task is idle,
+   * since the frames need to be collected before anything is pushed:
+   */
+  if (self->threaded) {
+    queue_wait_idle (self);
+  }
 
-      gst_structure_get_boolean (s, "interlaced", &interlaced);
+  self->gather = g_list_reverse (self->gather);
+  self->reverse_decoding = TRUE;
 
-      /* update output/padded sizes:
-       */
-      klass->update_buffer_size (self);
+  for (l = self->gather; l && (ret == GST_FLOW_OK); l = l->next) {
+    ret = gst_ducati_viddec_decode (self, l->data);
+    l->data = NULL;
+  }
 
-      self->outsize =
-          GST_ROUND_UP_2 (self->stride * self->padded_height * 3) / 2;
+  /* get the frames the codec is still holding on to for display: */
+  codec_drain (self, TRUE);
 
-      outcaps = gst_caps_new_simple ("video/x-raw-yuv-strided",
-          "rowstride", G_TYPE_INT, self->stride,
-          "format", GST_TYPE_FOURCC, GST_MAKE_FOURCC ('N','V','1','2'),
-          "width", G_TYPE_INT, self->padded_width,
-          "height", G_TYPE_INT, self->padded_height,
-          "framerate", GST_TYPE_FRACTION, frn, frd,
-          NULL);
+  self->reverse_decoding = FALSE;
 
-      if (interlaced) {
-        gst_caps_set_simple (outcaps, "interlaced", G_TYPE_BOOLEAN, TRUE, NULL);
-      }
+  for (l = self->decoded; l; l = l->next) {
+    GstBuffer *outbuf = l->data;
 
-      GST_DEBUG_OBJECT (self, "outcaps: %" GST_PTR_FORMAT, outcaps);
+    l->data = NULL;
 
-      ret = gst_pad_set_caps (self->srcpad, outcaps);
-      gst_caps_unref (outcaps);
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_unref (outbuf);
+      continue;
+    }
 
-      if (!ret) {
-        GST_WARNING_OBJECT (self, "failed to set caps");
-        return FALSE;
-      }
-    } else {
-      GST_WARNING_OBJECT (self, "missing required fields");
-      return FALSE;
+    if (discont) {
+      outbuf = gst_buffer_make_metadata_writable (outbuf);
+      GST_BUFFER_FLAG_SET (outbuf, GST_BUFFER_FLAG_DISCONT);
+      discont = FALSE;
     }
-  } else {
-    GST_INFO_OBJECT (self, "setcaps (src): %" GST_PTR_FORMAT, caps);
-    // XXX check to make sure caps are ok.. keep track if we
-    // XXX need to handle unstrided buffers..
-    GST_WARNING_OBJECT (self, "TODO");
+
+    ret = gst_pad_push (self->srcpad, outbuf);
   }
 
-  gst_object_unref (self);
+  reverse_clear (self);
 
-  return gst_pad_set_caps (pad, caps);
+  return ret;
 }
 
-static gboolean
-gst_ducati_viddec_query (GstPad * pad, GstQuery * query)
+/** gather a buffer of the current GOP in reverse playback */
+static GstFlowReturn
+reverse_chain (GstDucatiVidDec * self, GstBuffer * buf)
 {
-  GstDucatiVidDec *self = GST_DUCATIVIDDEC (GST_OBJECT_PARENT (pad));
+  GstFlowReturn ret = GST_FLOW_OK;
+  gboolean delta = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  /* each GOP upstream sends starts with a discont: */
+  if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DISCONT)) {
+    ret = reverse_flush (self);
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_unref (buf);
+      return ret;
+    }
+  }
 
-  GST_DEBUG_OBJECT (self, "query: %"GST_PTR_FORMAT, query);
+  if (self->gop_too_long && delta) {
+    gst_buffer_unref (buf);
+    return GST_FLOW_OK;
+  }
 
-  switch (GST_QUERY_TYPE (query)) {
-    case GST_QUERY_BUFFERS:
-      GST_DEBUG_OBJECT (self, "min buffers: %d", self->min_buffers);
-      gst_query_set_buffers_count (query, self->min_buffers);
+  self->gather = g_list_prepend (self->gather, buf);
+  self->n_gather++;
 
-      GST_DEBUG_OBJECT (self, "min dimensions: %dx%d",
-          self->padded_width, self->padded_height);
-      gst_query_set_buffers_dimensions (query,
-          self->padded_width, self->padded_height);
-      return TRUE;
-    default:
-      return FALSE;
+  if (G_UNLIKELY (self->n_gather > self->reverse_max_frames)) {
+    GList *l, *next;
+
+    if (!self->gop_too_long) {
+      GST_WARNING_OBJECT (self, "GOP longer than %d frames, only decoding "
+          "keyframes", self->reverse_max_frames);
+
+      for (l = self->gather; l; l = next) {
+        next = l->next;
+        if (GST_BUFFER_FLAG_IS_SET (l->data, GST_BUFFER_FLAG_DELTA_UNIT)) {
+          gst_buffer_unref (l->data);
+          self->gather = g_list_delete_link (self->gather, l);
+          self->n_gather--;
+        }
+      }
+
+      self->gop_too_long = TRUE;
+    }
+
+    /* even the keyframes alone are too many, so decode what we have: */
+    if (self->n_gather > self->reverse_max_frames) {
+      ret = reverse_flush (self);
+      self->gop_too_long = TRUE;
+    }
   }
+
+  return ret;
 }
 
 static GstFlowReturn
 gst_ducati_viddec_chain (GstPad * pad, GstBuffer * buf)
 {
   GstDucatiVidDec *self = GST_DUCATIVIDDEC (GST_OBJECT_PARENT (pad));
-  GstFlowReturn ret;
-  Int32 err;
-  GstBuffer *outbuf = NULL;
 
-  if (G_UNLIKELY (!self->engine)) {
-    GST_ERROR_OBJECT (self, "no engine");
-    return GST_FLOW_ERROR;
-  }
+  self->n_frames_in++;
 
-  /* do this before creating codec to ensure reverse caps negotiation
-   * happens first:
-   */
-  ret = gst_pad_alloc_buffer_and_set_caps (self->srcpad, 0, self->outsize,
-      GST_PAD_CAPS (self->srcpad), &outbuf);
+  input_resync (self);
 
-  if (ret != GST_FLOW_OK) {
-    outbuf = codec_bufferpool_get (self, NULL);
-    ret = GST_FLOW_OK;
+  /* in trick mode, drop delta frames before wasting time copying them: */
+  if (self->keyframes_only &&
+      GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    GST_LOG_OBJECT (self, "dropping delta unit");
+    gst_buffer_unref (buf);
+    return GST_FLOW_OK;
   }
 
-  if (G_UNLIKELY (!self->codec)) {
-    if (!codec_create (self)) {
-      GST_ERROR_OBJECT (self, "could not create codec");
-      return GST_FLOW_ERROR;
+  /* same when starting, or recovering from an error, until decoding can
+   * start:
+   */
+  if (G_UNLIKELY (self->wait_keyframe)) {
+    if (!GST_DUCATIVIDDEC_GET_CLASS (self)->is_sync_point (self, buf)) {
+      GST_LOG_OBJECT (self, "waiting for keyframe, dropping delta unit");
+      gst_buffer_unref (buf);
+      return GST_FLOW_OK;
     }
+    GST_DEBUG_OBJECT (self, "got keyframe");
+    self->wait_keyframe = FALSE;
   }
 
-  GST_BUFFER_TIMESTAMP (outbuf) = GST_BUFFER_TIMESTAMP (buf);
-  GST_BUFFER_DURATION (outbuf) = GST_BUFFER_DURATION (buf);
-
-  /* pass new output buffer as to the decoder to decode into: */
-  self->inArgs->inputID = codec_prepare_outbuf (self, outbuf);
-  if (!self->inArgs->inputID) {
-    GST_ERROR_OBJECT (self, "could not prepare output buffer");
-    return GST_FLOW_ERROR;
+  if (self->reverse) {
+    return reverse_chain (self, buf);
   }
 
-  self->in_size = 0;
-  buf = GST_DUCATIVIDDEC_GET_CLASS (self)->push_input (self, buf);
-
-  if (self->in_size == 0) {
-    GST_DEBUG_OBJECT (self, "no input, skipping process");
-    gst_buffer_unref (outbuf);
-    return GST_FLOW_OK;
+  if (self->threaded) {
+    return queue_push_input (self, buf);
   }
 
-  self->inArgs->numBytes = self->in_size;
-  self->inBufs->descs[0].bufSize.bytes = self->in_size;
+  return gst_ducati_viddec_decode (self, buf);
+}
 
-  if (buf) {
-    // XXX
-    GST_WARNING_OBJECT (self, "TODO.. can't push more than one.. need loop");
-    gst_buffer_unref (buf);
-    buf = NULL;
-  }
+/** handle an event in the thread which owns the codec */
+static gboolean
+gst_ducati_viddec_handle_event (GstDucatiVidDec * self, GstEvent * event)
+{
+  gboolean ret;
 
-  err = codec_process (self, TRUE, FALSE);
-  if (err) {
-    GST_ERROR_OBJECT (self, "process returned error: %d %08x",
-        err, self->outArgs->extendedError);
-    return GST_FLOW_ERROR;
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_EOS:
+      qos_reset (self);
+      ret = codec_flush (self, TRUE);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      /* frames decoded before the seek would just be dropped, so don't
+       * bother decoding them:
+       */
+      qos_reset (self);
+      ret = codec_discard (self);
+      if (self->wait_for_keyframe) {
+        codec_request_resync (self);
+      }
+      break;
+    default:
+      ret = TRUE;
+      break;
   }
 
-  self->first_in_buffer = FALSE;
-
-  if (self->outArgs->outBufsInUseFlag) {
-    GST_WARNING_OBJECT (self, "TODO... outBufsInUseFlag");      // XXX
+  if (!ret) {
+    GST_ERROR_OBJECT (self, "could not flush");
+    gst_event_unref (event);
+    return FALSE;
   }
 
-  return GST_FLOW_OK;
+  return gst_pad_push_event (self->srcpad, event);
 }
 
 static gboolean
@@ -669,25 +2489,73 @@ gst_ducati_viddec_event (GstPad * pad, GstEvent * event)
 {
   GstDucatiVidDec *self = GST_DUCATIVIDDEC (GST_OBJECT_PARENT (pad));
   gboolean ret = TRUE;
-  gboolean eos = FALSE;
 
   GST_INFO_OBJECT (self, "begin: event=%s", GST_EVENT_TYPE_NAME (event));
 
   switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_NEWSEGMENT: {
+      gdouble rate;
+
+      /* finish the last GOP of the previous segment first: */
+      reverse_flush (self);
+
+      gst_event_parse_new_segment (event, NULL, &rate, NULL, NULL, NULL, NULL);
+
+      GST_OBJECT_LOCK (self);
+      self->keyframes_only = self->seek_skip ||
+          (ABS (rate) > KEYFRAMES_ONLY_RATE);
+      GST_OBJECT_UNLOCK (self);
+
+      self->reverse = (rate < 0.0);
+
+      GST_DEBUG_OBJECT (self, "rate=%g, keyframes only: %d",
+          rate, self->keyframes_only);
+      break;
+    }
     case GST_EVENT_EOS:
-      eos = TRUE;
-      /* fall-through */
+      reverse_flush (self);
+      break;
     case GST_EVENT_FLUSH_STOP:
-      if (!codec_flush (self, eos)) {
-        GST_ERROR_OBJECT (self, "could not flush");
-        return FALSE;
-      }
-      /* fall-through */
+      reverse_clear (self);
+      break;
     default:
-      ret = gst_pad_push_event (self->srcpad, event);
       break;
   }
 
+  if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_START) {
+    self->flush_time = gst_util_get_timestamp ();
+    pool_set_flushing (self, TRUE);
+  } else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+    pool_set_flushing (self, FALSE);
+  }
+
+  if (!self->threaded) {
+    ret = gst_ducati_viddec_handle_event (self, event);
+  } else {
+    switch (GST_EVENT_TYPE (event)) {
+      case GST_EVENT_FLUSH_START:
+        /* forward first, to unblock the task if it is pushing downstream: */
+        ret = gst_pad_push_event (self->srcpad, event);
+        queue_flush (self, GST_FLOW_WRONG_STATE);
+        gst_pad_pause_task (self->srcpad);
+        break;
+      case GST_EVENT_FLUSH_STOP:
+        /* task is paused now, so we can call the codec from here: */
+        ret = gst_ducati_viddec_handle_event (self, event);
+        queue_flush (self, GST_FLOW_OK);
+        gst_pad_start_task (self->srcpad,
+            (GstTaskFunction) gst_ducati_viddec_loop, self);
+        break;
+      default:
+        if (GST_EVENT_IS_SERIALIZED (event)) {
+          ret = (queue_push (self, GST_MINI_OBJECT (event)) == GST_FLOW_OK);
+        } else {
+          ret = gst_pad_push_event (self->srcpad, event);
+        }
+        break;
+    }
+  }
+
   GST_LOG_OBJECT (self, "end");
 
   return ret;
@@ -710,6 +2578,18 @@ gst_ducati_viddec_change_state (GstElement * element,
         GST_ERROR_OBJECT (self, "could not open");
         return GST_STATE_CHANGE_FAILURE;
       }
+      gst_ducati_codec_cache_prewarm ();
+      break;
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      /* when joining a stream at a random point, don't decode anything
+       * that depends on frames we never got:
+       */
+      self->wait_keyframe = self->wait_for_keyframe;
+      pool_set_flushing (self, FALSE);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /* unblock the streaming thread if waiting for an output buffer: */
+      pool_set_flushing (self, TRUE);
       break;
     default:
       break;
@@ -721,8 +2601,14 @@ gst_ducati_viddec_change_state (GstElement * element,
     goto leave;
 
   switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      reverse_clear (self);
+      self->reverse = FALSE;
+      break;
     case GST_STATE_CHANGE_READY_TO_NULL:
       codec_delete (self);
+      pool_age_out (self, TRUE);
+      input_free (self);
       engine_close (self);
       break;
     default:
@@ -739,6 +2625,81 @@ leave:
 
 #define VERSION_LENGTH 256
 
+static void
+gst_ducati_viddec_set_property (GObject * obj,
+    guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+  GstDucatiVidDec *self = GST_DUCATIVIDDEC (obj);
+
+  switch (prop_id) {
+    case PROP_THREADED:
+      /* can't switch the thread which owns the codec while streaming: */
+      if (GST_STATE (self) > GST_STATE_READY) {
+        GST_WARNING_OBJECT (self, "can't change threaded mode while running");
+        break;
+      }
+      self->threaded = g_value_get_boolean (value);
+      break;
+    case PROP_QUEUE_SIZE:
+      GST_DUCATIVIDDEC_QUEUE_LOCK (self);
+      self->queue_size = g_value_get_uint (value);
+      GST_DUCATIVIDDEC_QUEUE_SIGNAL (self);
+      GST_DUCATIVIDDEC_QUEUE_UNLOCK (self);
+      break;
+    case PROP_INPUT_BUFFERS:
+      /* takes effect the next time input buffers are allocated: */
+      self->num_inputs = g_value_get_uint (value);
+      break;
+    case PROP_MAX_WIDTH:
+      /* takes effect the next time the codec is created: */
+      self->max_width = g_value_get_uint (value);
+      break;
+    case PROP_MAX_HEIGHT:
+      self->max_height = g_value_get_uint (value);
+      break;
+    case PROP_PRIORITY:
+      self->sched.priority = g_value_get_int (value);
+      break;
+    case PROP_DEADLINE:
+      self->sched.deadline = g_value_get_uint (value) * GST_MSECOND;
+      break;
+    case PROP_REVERSE_MAX_FRAMES:
+      self->reverse_max_frames = g_value_get_uint (value);
+      break;
+    case PROP_LOW_LATENCY:
+      /* takes effect the next time the codec is created: */
+      self->low_latency = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_ERRORS:
+      self->max_errors = g_value_get_uint (value);
+      break;
+    case PROP_WAIT_FOR_KEYFRAME:
+      self->wait_for_keyframe = g_value_get_boolean (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      self->stats_interval = g_value_get_uint (value);
+      break;
+    case PROP_MAX_OUTPUT_BUFFERS:
+      self->max_output_buffers = g_value_get_uint (value);
+      break;
+    case PROP_POOL_TIMEOUT:
+      self->pool_timeout = g_value_get_uint (value) * GST_MSECOND;
+      break;
+    case PROP_POOL_IDLE_TIMEOUT:
+      self->pool_idle_timeout = g_value_get_uint (value) * GST_MSECOND;
+      break;
+    case PROP_POOL_HIGH_WATER:
+      self->pool_high_water = g_value_get_uint (value);
+      break;
+    case PROP_FRAME_CACHE_QUOTA:
+      self->frame_cache_quota = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+      break;
+  }
+}
+
 static void
 gst_ducati_viddec_get_property (GObject * obj,
     guint prop_id, GValue * value, GParamSpec * pspec)
@@ -746,9 +2707,76 @@ gst_ducati_viddec_get_property (GObject * obj,
   GstDucatiVidDec *self = GST_DUCATIVIDDEC (obj);
 
   switch (prop_id) {
+    case PROP_THREADED:
+      g_value_set_boolean (value, self->threaded);
+      break;
+    case PROP_QUEUE_SIZE:
+      g_value_set_uint (value, self->queue_size);
+      break;
+    case PROP_INPUT_BUFFERS:
+      g_value_set_uint (value, self->num_inputs);
+      break;
+    case PROP_MAX_WIDTH:
+      g_value_set_uint (value, self->max_width);
+      break;
+    case PROP_MAX_HEIGHT:
+      g_value_set_uint (value, self->max_height);
+      break;
+    case PROP_PRIORITY:
+      g_value_set_int (value, self->sched.priority);
+      break;
+    case PROP_DEADLINE:
+      g_value_set_uint (value, self->sched.deadline / GST_MSECOND);
+      break;
+    case PROP_ACCELERATOR_TIME:
+      g_value_set_uint64 (value, self->sched.busy_time);
+      break;
+    case PROP_REVERSE_MAX_FRAMES:
+      g_value_set_uint (value, self->reverse_max_frames);
+      break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, self->low_latency);
+      break;
+    case PROP_SEEK_LATENCY:
+      g_value_set_uint64 (value, self->seek_latency);
+      break;
+    case PROP_MAX_ERRORS:
+      g_value_set_uint (value, self->max_errors);
+      break;
+    case PROP_ERRORS:
+      g_value_set_uint (value, self->n_errors);
+      break;
+    case PROP_RECOVERY_TIME:
+      g_value_set_uint64 (value, self->recovery_time);
+      break;
+    case PROP_WAIT_FOR_KEYFRAME:
+      g_value_set_boolean (value, self->wait_for_keyframe);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, stats_new (self));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, self->stats_interval);
+      break;
+    case PROP_MAX_OUTPUT_BUFFERS:
+      g_value_set_uint (value, self->max_output_buffers);
+      break;
+    case PROP_POOL_TIMEOUT:
+      g_value_set_uint (value, self->pool_timeout / GST_MSECOND);
+      break;
+    case PROP_POOL_IDLE_TIMEOUT:
+      g_value_set_uint (value, self->pool_idle_timeout / GST_MSECOND);
+      break;
+    case PROP_POOL_HIGH_WATER:
+      g_value_set_uint (value, self->pool_high_water);
+      break;
+    case PROP_FRAME_CACHE_QUOTA:
+      g_value_set_uint (value, self->frame_cache_quota);
+      break;
     case PROP_VERSION: {
       int err;
       char *version = gst_ducati_alloc_1d (VERSION_LENGTH);
+      gboolean probe = !self->codec;
 
       /* in case something fails: */
       snprintf (version, VERSION_LENGTH, "unsupported");
@@ -773,6 +2801,14 @@ gst_ducati_viddec_get_property (GObject * obj,
         self->status->data.bufSize = 0;
       }
 
+      /* a codec only created to get the version (at whatever resolution
+       * is set so far) is not worth caching:
+       */
+      if (probe && self->codec) {
+        VIDDEC3_delete (self->codec);
+        self->codec = NULL;
+      }
+
       g_value_set_string (value, version);
 
       MemMgr_Free (version);
@@ -791,14 +2827,23 @@ gst_ducati_viddec_finalize (GObject * obj)
 {
   GstDucatiVidDec *self = GST_DUCATIVIDDEC (obj);
 
+  reverse_clear (self);
   codec_delete (self);
+  pool_age_out (self, TRUE);
+  input_free (self);
   engine_close (self);
+  gst_ducati_cache_account_unref (self->cache_account);
 
   if (self->codec_data) {
       gst_buffer_unref (self->codec_data);
       self->codec_data = NULL;
   }
 
+  queue_flush (self, GST_FLOW_WRONG_STATE);
+  g_queue_free (self->queue);
+  g_mutex_free (self->queue_lock);
+  g_cond_free (self->queue_cond);
+
   G_OBJECT_CLASS (parent_class)->finalize (obj);
 }
 
@@ -817,6 +2862,8 @@ gst_ducati_viddec_class_init (GstDucatiVidDecClass * klass)
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
 
+  gobject_class->set_property =
+      GST_DEBUG_FUNCPTR (gst_ducati_viddec_set_property);
   gobject_class->get_property =
       GST_DEBUG_FUNCPTR (gst_ducati_viddec_get_property);
   gobject_class->finalize =
@@ -830,11 +2877,155 @@ gst_ducati_viddec_class_init (GstDucatiVidDecClass * klass)
       GST_DEBUG_FUNCPTR (gst_ducati_viddec_allocate_params);
   klass->push_input =
       GST_DEBUG_FUNCPTR (gst_ducati_viddec_push_input);
+  klass->is_sync_point =
+      GST_DEBUG_FUNCPTR (gst_ducati_viddec_is_sync_point);
 
   g_object_class_install_property (gobject_class, PROP_VERSION,
       g_param_spec_string ("version", "Version",
           "The codec version string", "",
           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_THREADED,
+      g_param_spec_boolean ("threaded", "Threaded",
+          "Decode in a separate thread, so that input can be queued while "
+          "the codec is busy", DEFAULT_THREADED,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_QUEUE_SIZE,
+      g_param_spec_uint ("queue-size", "Queue size",
+          "Max number of buffers/events queued in threaded mode",
+          1, 64, DEFAULT_QUEUE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_INPUT_BUFFERS,
+      g_param_spec_uint ("input-buffers", "Input buffers",
+          "Number of input buffers in threaded mode, so input can be copied "
+          "while the codec is busy", 1, GST_DUCATIVIDDEC_MAX_INPUTS,
+          DEFAULT_INPUT_BUFFERS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_WIDTH,
+      g_param_spec_uint ("max-width", "Max width",
+          "Max video width to create the codec for, so that resolution "
+          "changes don't re-create the codec (0 = current width)",
+          0, 4096, DEFAULT_MAX_WIDTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_HEIGHT,
+      g_param_spec_uint ("max-height", "Max height",
+          "Max video height to create the codec for, so that resolution "
+          "changes don't re-create the codec (0 = current height)",
+          0, 4096, DEFAULT_MAX_HEIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PRIORITY,
+      g_param_spec_int ("priority", "Priority",
+          "Priority for the accelerator when shared with other decoders, "
+          "higher priority decoders always go first", -100, 100,
+          DEFAULT_PRIORITY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DEADLINE,
+      g_param_spec_uint ("deadline", "Deadline",
+          "Max time (in ms) to wait for the accelerator when shared with "
+          "other decoders of the same priority, with GST_DUCATI_SCHED=edf "
+          "(0 = none)", 0, G_MAXUINT, DEFAULT_DEADLINE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ACCELERATOR_TIME,
+      g_param_spec_uint64 ("accelerator-time", "Accelerator time",
+          "Total time (in ns) spent decoding on the accelerator",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_REVERSE_MAX_FRAMES,
+      g_param_spec_uint ("reverse-max-frames", "Reverse max frames",
+          "Max number of frames of a GOP to hold in reverse playback, "
+          "beyond which only keyframes are decoded", 1, 256,
+          DEFAULT_REVERSE_MAX_FRAMES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Output frames as soon as they are decoded instead of letting the "
+          "codec hold them back (for H.264, only for streams without "
+          "B-frames)", DEFAULT_LOW_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SEEK_LATENCY,
+      g_param_spec_uint64 ("seek-latency", "Seek latency",
+          "Time (in ns) from the last flushing seek until the first frame "
+          "after it was decoded", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_ERRORS,
+      g_param_spec_uint ("max-errors", "Max errors",
+          "Max number of fatal decode errors in a row to recover from, by "
+          "waiting for the next keyframe, before failing (0 = don't recover)",
+          0, G_MAXUINT, DEFAULT_MAX_ERRORS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ERRORS,
+      g_param_spec_uint ("errors", "Errors",
+          "Number of decode errors", 0, G_MAXUINT, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RECOVERY_TIME,
+      g_param_spec_uint64 ("recovery-time", "Recovery time",
+          "Time (in ns) it took to recover from the last decode error",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WAIT_FOR_KEYFRAME,
+      g_param_spec_boolean ("wait-for-keyframe", "Wait for keyframe",
+          "Drop input until a point where decoding can start (a keyframe, "
+          "or for H.264 an IDR or recovery point) after starting or seeking",
+          DEFAULT_WAIT_FOR_KEYFRAME,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Stats",
+          "Decoder statistics: frames in/out, process() times (in ns), "
+          "bytes copied, bufferpool hits/misses, errors, etc",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Stats interval",
+          "Interval (in ms) to post the stats at as element messages on the "
+          "bus (0 = never)", 0, G_MAXUINT, DEFAULT_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_OUTPUT_BUFFERS,
+      g_param_spec_uint ("max-output-buffers", "Max output buffers",
+          "Max number of buffers in the output bufferpool, when downstream "
+          "doesn't provide them (0 = twice the number the codec requires)",
+          0, G_MAXUINT, DEFAULT_MAX_OUTPUT_BUFFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_POOL_TIMEOUT,
+      g_param_spec_uint ("pool-timeout", "Pool timeout",
+          "Max time (in ms) to wait for downstream to return an output buffer "
+          "when all of them are in use, before allocating another one",
+          0, G_MAXUINT, DEFAULT_POOL_TIMEOUT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_POOL_IDLE_TIMEOUT,
+      g_param_spec_uint ("pool-idle-timeout", "Pool idle timeout",
+          "Time (in ms) after which unused buffers in the bufferpools are "
+          "freed (0 = never)", 0, G_MAXUINT, DEFAULT_POOL_IDLE_TIMEOUT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_POOL_HIGH_WATER,
+      g_param_spec_uint ("pool-high-water", "Pool high water",
+          "Max number of unused buffers to keep in the bufferpools, beyond "
+          "which returned buffers are freed (0 = no limit)",
+          0, G_MAXUINT, DEFAULT_POOL_HIGH_WATER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRAME_CACHE_QUOTA,
+      g_param_spec_uint ("frame-cache-quota", "Frame cache quota",
+          "Max number of freed buffers to keep in the frame cache shared "
+          "with other ducati elements (0 = don't share)",
+          0, G_MAXUINT, DEFAULT_FRAME_CACHE_QUOTA,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  klass->low_latency_display_delay = IVIDDEC3_DISPLAY_DELAY_1;
 }
 
 static void
@@ -850,12 +3041,18 @@ gst_ducati_viddec_init (GstDucatiVidDec * self, GstDucatiVidDecClass * klass)
       GST_DEBUG_FUNCPTR (gst_ducati_viddec_chain));
   gst_pad_set_event_function (self->sinkpad,
       GST_DEBUG_FUNCPTR (gst_ducati_viddec_event));
+  gst_pad_set_bufferalloc_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_ducati_viddec_buffer_alloc));
 
   self->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
   gst_pad_set_setcaps_function (self->srcpad,
       GST_DEBUG_FUNCPTR (gst_ducati_viddec_set_caps));
+  gst_pad_set_event_function (self->srcpad,
+      GST_DEBUG_FUNCPTR (gst_ducati_viddec_src_event));
   gst_pad_set_query_function (self->srcpad,
           GST_DEBUG_FUNCPTR (gst_ducati_viddec_query));
+  gst_pad_set_activatepush_function (self->srcpad,
+      GST_DEBUG_FUNCPTR (gst_ducati_viddec_src_activate_push));
 
   gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
   gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
@@ -865,4 +3062,60 @@ gst_ducati_viddec_init (GstDucatiVidDec * self, GstDucatiVidDecClass * klass)
    */
   self->width = 128;
   self->height = 128;
+
+  self->threaded = DEFAULT_THREADED;
+  self->queue_size = DEFAULT_QUEUE_SIZE;
+  self->num_inputs = DEFAULT_INPUT_BUFFERS;
+  self->max_width = DEFAULT_MAX_WIDTH;
+  self->max_height = DEFAULT_MAX_HEIGHT;
+  self->sched.priority = DEFAULT_PRIORITY;
+  self->sched.deadline = DEFAULT_DEADLINE;
+  self->reverse_max_frames = DEFAULT_REVERSE_MAX_FRAMES;
+  self->low_latency = DEFAULT_LOW_LATENCY;
+  self->flush_time = GST_CLOCK_TIME_NONE;
+  self->max_errors = DEFAULT_MAX_ERRORS;
+  self->error_time = GST_CLOCK_TIME_NONE;
+  self->wait_for_keyframe = DEFAULT_WAIT_FOR_KEYFRAME;
+  self->stats_interval = DEFAULT_STATS_INTERVAL;
+  self->max_output_buffers = DEFAULT_MAX_OUTPUT_BUFFERS;
+  self->pool_timeout = DEFAULT_POOL_TIMEOUT * GST_MSECOND;
+  self->pool_idle_timeout = DEFAULT_POOL_IDLE_TIMEOUT * GST_MSECOND;
+  self->pool_high_water = DEFAULT_POOL_HIGH_WATER;
+  self->frame_cache_quota = DEFAULT_FRAME_CACHE_QUOTA;
+  self->cache_account = gst_ducati_cache_account_new ();
+  self->stats_time = GST_CLOCK_TIME_NONE;
+  self->process_time_min = GST_CLOCK_TIME_NONE;
+  self->queue = g_queue_new ();
+  self->queue_lock = g_mutex_new ();
+  self->queue_cond = g_cond_new ();
+  self->srcresult = GST_FLOW_WRONG_STATE;
+
+  outbuf_reset (self);
+}
+
+/** create a codec instance for element 'type' at the given resolution, and
+ * leave it in the codec cache so the first element to need it doesn't have
+ * to wait for it to be created
+ */
+void
+gst_ducati_viddec_prewarm (GType type, gint width, gint height)
+{
+  GstDucatiVidDec *self;
+
+  g_return_if_fail (g_type_is_a (type, GST_TYPE_DUCATIVIDDEC));
+
+  self = g_object_new (type, NULL);
+
+  self->width = ALIGN2 (width, 4);
+  self->height = ALIGN2 (height, 4);
+
+  if (engine_open (self) && codec_create (self)) {
+    if (!gst_ducati_codec_cache_put (GST_DUCATIVIDDEC_GET_CLASS (self)->
+            codec_name, self->params, self->codec, TRUE)) {
+      VIDDEC3_delete (self->codec);
+    }
+    self->codec = NULL;
+  }
+
+  gst_object_unref (self);
 }
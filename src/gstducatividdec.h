@@ -35,8 +35,47 @@ G_BEGIN_DECLS
 #define GST_IS_DUCATIVIDDEC_CLASS(klass)    (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_DUCATIVIDDEC))
 #define GST_DUCATIVIDDEC_GET_CLASS(obj)     (G_TYPE_INSTANCE_GET_CLASS((obj), GST_TYPE_DUCATIVIDDEC, GstDucatiVidDecClass))
 
+/* max number of input buffers in the ring: */
+#define GST_DUCATIVIDDEC_MAX_INPUTS  8
+
+/* input buffers allocated for upstream come from one pool per size class:
+ * the smallest size class, the number of classes (each twice the size of
+ * the previous one, up to the max input size), and the max number of
+ * buffers in each pool, beyond which upstream gets normal buffers:
+ */
+#define GST_DUCATIVIDDEC_MIN_INPUT_POOL_SIZE (16 * 1024)
+#define GST_DUCATIVIDDEC_INPUT_POOLS 12
+#define GST_DUCATIVIDDEC_MAX_INPUT_POOL_BUFFERS 16
+
+/* max number of output bufferpools kept for reuse after the resolution
+ * changed:
+ */
+#define GST_DUCATIVIDDEC_MAX_OLD_POOLS 4
+
+/* max number of output buffers the codec can hold at once: */
+#define GST_DUCATIVIDDEC_MAX_OUTBUFS 32
+
+/* number of buckets in the process() time histogram, and bucket width: */
+#define GST_DUCATIVIDDEC_PROCESS_BUCKETS 256
+#define GST_DUCATIVIDDEC_PROCESS_BUCKET_WIDTH (100 * GST_USECOND)
+
 typedef struct _GstDucatiVidDec      GstDucatiVidDec;
 typedef struct _GstDucatiVidDecClass GstDucatiVidDecClass;
+typedef struct _GstDucatiVidDecOutBuf GstDucatiVidDecOutBuf;
+
+/* an output buffer passed to the codec.  The ID given to the codec encodes
+ * the slot index and generation, so stale IDs can be detected:
+ */
+struct _GstDucatiVidDecOutBuf
+{
+  GstBuffer *buf;
+  guint gen;
+  GstClockTime locked;       /* when the buffer was given to the codec */
+
+  /* timestamp of the input frame decoded into the buffer: */
+  GstClockTime ts, duration;
+  gboolean output;           /* codec has output the buffer for display */
+};
 
 struct _GstDucatiVidDec
 {
@@ -46,12 +85,64 @@ struct _GstDucatiVidDec
 
   GstDucatiBufferPool *pool;
 
+  /* output pools for previous resolutions, most recently used first (with
+   * object lock).  A pool is reused when its buffers have the same height
+   * and at least the same width (the stride is always the same), until it
+   * was unused for longer than pool_idle_timeout:
+   */
+  GList *old_pools;
+
+  /* to age out old output pools even when no more output buffers are taken
+   * from our pools (with object lock).  Holds a ref to the element, so it
+   * is cancelled when going to NULL:
+   */
+  GstClockID old_pools_timer;
+
+  /* max number of buffers in the output pool (0 = twice min_buffers), how
+   * long to wait for one to be returned at the limit, and whether to stop
+   * waiting because of a flush (with object lock):
+   */
+  guint max_output_buffers;
+  GstClockTime pool_timeout;
+  gboolean pool_flushing;
+
+  /* how long buffers can stay unused in our pools before they are freed,
+   * and max number of unused buffers to keep (0 = no limit):
+   */
+  GstClockTime pool_idle_timeout;
+  guint pool_high_water;
+
+  /* max number of freed buffers of our pools (all of them together, which
+   * share the account) that the plugin wide frame cache keeps for other
+   * elements to use:
+   */
+  guint frame_cache_quota;
+  GstDucatiCacheAccount *cache_account;
+
+  /* pools of 1D buffers handed out to upstream from sinkpad bufferalloc,
+   * by size class:
+   */
+  GstDucatiBufferPool *input_pools[GST_DUCATIVIDDEC_INPUT_POOLS];
+
   /* minimum output size required by the codec: */
   gint outsize;
 
   /* minimum number of buffers required by the codec: */
   gint min_buffers;
 
+  /* max number of frames the codec can hold back for display when it is
+   * left to pick the display delay (IVIDDEC3_DISPLAY_DELAY_AUTO):
+   */
+  gint max_display_delay;
+
+  /* display delay set by allocate_params(), and whether to use the class's
+   * low_latency_display_delay instead:
+   */
+  gint display_delay;
+  gboolean low_latency;
+
+  gint fps_n, fps_d;
+
   /* input (unpadded) size of video: */
   gint width, height;
 
@@ -61,21 +152,164 @@ struct _GstDucatiVidDec
   /* output stride (>= padded_width) */
   gint stride;
 
-  /* input buffer, allocated when codec is created: */
+  /* QoS: number of consecutive late/early QoS events, and the frame skip
+   * level they call for (with object lock), vs the one set on the codec:
+   */
+  guint qos_late, qos_early;
+  gint qos_level;
+  gint skip_level;
+
+  /* trick mode: only decode keyframes, if the last seek had the SKIP flag
+   * (with object lock) or the segment rate is high:
+   */
+  gboolean seek_skip;
+  gboolean keyframes_only;
+
+  /* reverse playback: upstream sends GOPs in reverse order, so input is
+   * gathered until the next GOP starts, then decoded forward and the
+   * decoded frames are pushed in reverse order.  If a GOP has more than
+   * reverse_max_frames frames, only its keyframes are decoded:
+   */
+  gboolean reverse;
+  guint reverse_max_frames;
+  GList *gather;             /* input of current GOP, newest first */
+  guint n_gather;
+  gboolean gop_too_long;
+  gboolean reverse_decoding; /* decoded frames go to 'decoded' */
+  GList *decoded;            /* decoded frames of current GOP, newest first */
+
+  /* for sharing the accelerator with other elements: */
+  GstDucatiSchedClient sched;
+
+  /* if set, codec is created for this max resolution so that resolution
+   * changes within it only need the codec to be reconfigured:
+   */
+  guint max_width, max_height;
+
+  /* ring of input buffers, allocated on first input buffer.  In threaded
+   * mode, _chain() copies into the next free one while the codec is still
+   * busy with the previous one:
+   */
+  guint num_inputs;          /* requested number of input buffers */
+  guint n_inputs;            /* allocated number of input buffers */
+  guint next_input;
+  guint8 *inputs[GST_DUCATIVIDDEC_MAX_INPUTS];
+  SSPtr input_paddrs[GST_DUCATIVIDDEC_MAX_INPUTS];
+  gboolean input_busy[GST_DUCATIVIDDEC_MAX_INPUTS];  /* with queue_lock */
+
+  /* if input was already in memory the codec can access, it is passed to
+   * the codec directly and held until the codec is done with it, instead
+   * of copying to inputs[]:
+   */
+  GstBuffer *input_bufs[GST_DUCATIVIDDEC_MAX_INPUTS];  /* with queue_lock */
+  SSPtr input_buf_paddrs[GST_DUCATIVIDDEC_MAX_INPUTS]; /* with queue_lock */
+
+  /* current input buffer (one of inputs[]) that push_input() copies to: */
   guint8 *input;
 
-  /* number of bytes pushed to input on current frame: */
+  /* number of bytes pushed to input on current frame, only used while
+   * staging input (which is the sink thread in threaded mode):
+   */
   gint in_size;
 
+  /* input pushed without copying on current frame, if any, and where it
+   * starts (which may be in front of the buffer data, if a header was
+   * written there):
+   */
+  GstBuffer *in_buf;
+  guint8 *in_data;
+  SSPtr in_paddr;
+
   /* on first output buffer, we need to send crop info to sink.. and some
    * operations like flushing should be avoided if we haven't sent any
    * input buffers:
    */
   gboolean first_out_buffer, first_in_buffer;
 
+  /* output buffer ID the codec is still decoding into (outBufsInUseFlag
+   * was set, for ex. after the first field of an interlaced frame), which
+   * is passed again on the next process() call instead of a new one:
+   */
+  XDAS_Int32 pending_id;
+
+  /* table of output buffers given to the codec, indexed by ID: */
+  GstDucatiVidDecOutBuf outbufs[GST_DUCATIVIDDEC_MAX_OUTBUFS];
+  guint8 free_outbufs[GST_DUCATIVIDDEC_MAX_OUTBUFS];  /* stack of free slots */
+  guint n_free_outbufs;
+
+  /* timestamps of frames given to the codec but not output yet, sorted,
+   * since with frame reordering they come out in presentation order:
+   */
+  GstClockTime pts[GST_DUCATIVIDDEC_MAX_OUTBUFS];
+  guint n_pts;
+
+  /* error recovery: after a decode error, input is dropped until the next
+   * keyframe, and only after max_errors fatal errors in a row do we give up:
+   */
+  guint max_errors;
+  guint consecutive_errors;
+  gboolean wait_keyframe;    /* staging thread, before input is staged */
+  gboolean skip_to_keyframe; /* decoding thread, for input already staged */
+  gboolean wait_for_keyframe; /* also wait for a keyframe when starting */
+
+  /* the decoding thread (the task, in threaded mode) asks the staging
+   * thread (the sink thread) to wait for a keyframe with 'resync', and to
+   * send codec_data again after a codec reset by incrementing codec_gen.
+   * Input staged for an older codec_gen is dropped.  With queue_lock,
+   * except staged_gen, which only the staging thread uses:
+   */
+  gboolean resync;
+  guint codec_gen, staged_gen;
+  guint input_gens[GST_DUCATIVIDDEC_MAX_INPUTS];
+
+  GstClockTime error_time;   /* when recovery started */
+  GstClockTime recovery_time;
+  guint n_errors, n_fatal_errors;
+
+  /* time of the last flush (for seeks), until the first frame after it is
+   * output, and how long that took:
+   */
+  GstClockTime flush_time;
+  GstClockTime seek_latency;
+
+  /* how long output buffers were held by the codec, for pool sizing: */
+  guint n_locked, max_locked;
+  guint lock_count;
+  GstClockTime lock_time_total, lock_time_max;
+
+  /* statistics for monitoring.  Updated by the streaming thread(s) without
+   * locking, so they are only approximate while running, except pool_hits
+   * and pool_misses (counts of pools already destroyed, with object lock):
+   */
+  guint n_frames_in, n_frames_out;
+  guint64 bytes_copied;      /* by push_input() */
+  guint pool_hits, pool_misses;
+  guint n_fallbacks;         /* non-TILER output buffers replaced */
+  guint n_process;
+  GstClockTime process_time_total, process_time_min, process_time_max;
+  guint process_hist[GST_DUCATIVIDDEC_PROCESS_BUCKETS];
+
+  /* interval (in ms, 0 = never) to post stats as element messages at, and
+   * when they were last posted:
+   */
+  guint stats_interval;
+  GstClockTime stats_time;
+
   /* by default, codec_data from sinkpad is prepended to first buffer: */
   GstBuffer *codec_data;
 
+  /* in threaded mode, _chain() just queues up input buffers and serialized
+   * events, and the codec is driven from a task on the srcpad:
+   */
+  gboolean threaded;
+  guint queue_size;
+
+  GQueue *queue;             /* buffers/events, with queue_lock */
+  GMutex *queue_lock;
+  GCond *queue_cond;
+  GstFlowReturn srcresult;   /* with queue_lock */
+  gboolean busy;             /* task is processing an item, with queue_lock */
+
   Engine_Handle           engine;
   VIDDEC3_Handle          codec;
   VIDDEC3_Params         *params;
@@ -93,6 +327,14 @@ struct _GstDucatiVidDecClass
 
   const gchar *codec_name;
 
+  /* space to reserve in front of buffers allocated for upstream, so any
+   * header that push_input() prepends can be written in place:
+   */
+  gint input_headroom;
+
+  /* display delay to use in low-latency mode: */
+  gint low_latency_display_delay;
+
   /**
    * Parse codec specific fields the given caps structure.  The base-
    * class implementation of this method handles standard stuff like
@@ -117,18 +359,100 @@ struct _GstDucatiVidDecClass
    * any remaining data, or NULL if none.  Consumes reference to 'buf'
    */
   GstBuffer * (*push_input) (GstDucatiVidDec * self, GstBuffer * buf);
+
+  /**
+   * Check if decoding can start from the given buffer.  The base-class
+   * implementation checks that it is not a delta unit.
+   */
+  gboolean (*is_sync_point) (GstDucatiVidDec * self, GstBuffer * buf);
 };
 
 GType gst_ducati_viddec_get_type (void);
+void gst_ducati_viddec_prewarm (GType type, gint width, gint height);
+
+#define GST_DUCATIVIDDEC_QUEUE_LOCK(self)      g_mutex_lock ((self)->queue_lock)
+#define GST_DUCATIVIDDEC_QUEUE_UNLOCK(self)    g_mutex_unlock ((self)->queue_lock)
+#define GST_DUCATIVIDDEC_QUEUE_WAIT(self)      g_cond_wait ((self)->queue_cond, (self)->queue_lock)
+#define GST_DUCATIVIDDEC_QUEUE_SIGNAL(self)    g_cond_broadcast ((self)->queue_cond)
+
+/* the codec is only ever called from one thread at a time, which is the
+ * sinkpad streaming thread, or the srcpad task in threaded mode:
+ */
+#define GST_DUCATIVIDDEC_CODEC_LOCK(self)   \
+    GST_PAD_STREAM_LOCK ((self)->threaded ? (self)->srcpad : (self)->sinkpad)
+#define GST_DUCATIVIDDEC_CODEC_UNLOCK(self) \
+    GST_PAD_STREAM_UNLOCK ((self)->threaded ? (self)->srcpad : (self)->sinkpad)
 
 /* helper methods for derived classes: */
 
 static inline void
 push_input (GstDucatiVidDec * self, guint8 *in, gint sz)
 {
+  if (G_UNLIKELY (self->in_buf)) {
+    /* something was already pushed without copying, so that needs to be
+     * copied after all:
+     */
+    memcpy (self->input, self->in_data, self->in_size);
+    gst_buffer_unref (self->in_buf);
+    self->in_buf = NULL;
+    self->bytes_copied += self->in_size;
+  }
   GST_DEBUG_OBJECT (self, "push: %d bytes)", sz);
   memcpy (self->input + self->in_size, in, sz);
   self->in_size += sz;
+  self->bytes_copied += sz;
+}
+
+/* push the entire contents of a buffer.  If it is the first thing pushed
+ * on this frame, and is already in memory the codec can access (for ex,
+ * allocated by upstream from MemMgr), it is not copied at all
+ */
+static inline void
+push_input_buffer (GstDucatiVidDec * self, GstBuffer * buf)
+{
+  if (self->in_size == 0) {
+    SSPtr paddr = TilerMem_VirtToPhys (GST_BUFFER_DATA (buf));
+    if (paddr && (gst_ducati_get_mem_type (paddr) == XDM_MEMTYPE_RAW)) {
+      GST_DEBUG_OBJECT (self, "push: %d bytes (no copy)", GST_BUFFER_SIZE (buf));
+      self->in_buf = gst_buffer_ref (buf);
+      self->in_data = GST_BUFFER_DATA (buf);
+      self->in_paddr = paddr;
+      self->in_size = GST_BUFFER_SIZE (buf);
+      return;
+    }
+  }
+  push_input (self, GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
+}
+
+/* push a header followed by the contents of a buffer starting at 'offset'.
+ * If the buffer was allocated by our sinkpad bufferalloc with enough room
+ * in front of the data at 'offset', and we may write to it, the header is
+ * written there instead, so the buffer does not need to be copied
+ */
+static inline void
+push_input_with_header (GstDucatiVidDec * self, guint8 *hdr, gint hdr_sz,
+    GstBuffer * buf, gint offset)
+{
+  guint8 *data = GST_BUFFER_DATA (buf) + offset;
+  gint sz = GST_BUFFER_SIZE (buf) - offset;
+
+  /* (our only pools of 1D buffers are the input pools) */
+  if ((self->in_size == 0) && GST_IS_DUCATIBUFFER (buf) &&
+      (GST_DUCATIBUFFER (buf)->pool->element == GST_ELEMENT (self)) &&
+      GST_DUCATIBUFFER (buf)->pool->size &&
+      (hdr_sz <= offset + (gint) GST_DUCATIBUFFER (buf)->pool->headroom) &&
+      gst_buffer_is_writable (buf)) {
+    data -= hdr_sz;
+    memcpy (data, hdr, hdr_sz);
+    GST_DEBUG_OBJECT (self, "push: %d+%d bytes (no copy)", hdr_sz, sz);
+    self->in_buf = gst_buffer_ref (buf);
+    self->in_data = data;
+    self->in_paddr = TilerMem_VirtToPhys (data);
+    self->in_size = hdr_sz + sz;
+    return;
+  }
+  push_input (self, hdr, hdr_sz);
+  push_input (self, data, sz);
 }
 
 G_END_DECLS
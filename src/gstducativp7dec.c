@@ -101,9 +101,7 @@ gst_ducati_vp7dec_push_input (GstDucatiVidDec * vdec, GstBuffer * buf)
 
   /* current codec version requires size prepended on input buffer: */
   sz = GST_BUFFER_SIZE (buf);
-  push_input (vdec, (guint8 *)&sz, 4);
-
-  push_input (vdec, GST_BUFFER_DATA (buf), sz);
+  push_input_with_header (vdec, (guint8 *)&sz, 4, buf, 0);
   gst_buffer_unref (buf);
 
   return NULL;
@@ -132,6 +130,7 @@ gst_ducati_vp7dec_class_init (GstDucatiVP7DecClass * klass)
 {
   GstDucatiVidDecClass *bclass = GST_DUCATIVIDDEC_CLASS (klass);
   bclass->codec_name = "ivahd_vp7dec";
+  bclass->input_headroom = 4;
   bclass->update_buffer_size =
       GST_DEBUG_FUNCPTR (gst_ducati_vp7dec_update_buffer_size);
   bclass->allocate_params =
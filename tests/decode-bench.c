@@ -0,0 +1,190 @@
+/*
+ * GStreamer
+ * Copyright (c) 2010, Texas Instruments Incorporated
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * decode benchmark: runs ducatih264dec against the fake codec of fake-dce.c,
+ * whose process() blocks for --latency us like a call to ducati would, to
+ * measure how much of the work on the ARM side (copying the input, getting
+ * output buffers, pushing) the threaded mode overlaps with the codec:
+ *
+ *   ./decode-bench --latency=20000
+ *   ./decode-bench --latency=20000 --threaded
+ *
+ * and how far ahead of the codec input can be staged with more than one
+ * input buffer (the rate at which the decoder takes input is also shown):
+ *
+ *   ./decode-bench --latency=20000 --threaded --input-buffers=1
+ *   ./decode-bench --latency=20000 --threaded --input-buffers=4
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "fake-dce.h"
+#include "gstducatih264dec.h"
+
+/* defined by GST_PLUGIN_DEFINE() in gstducati.c: */
+extern GstPluginDesc gst_plugin_desc;
+
+static gint frames = 300;
+static gint frame_size = 256 * 1024;
+static gint width = 1920, height = 1088;
+static gint latency = 20000;
+static gboolean threaded = FALSE;
+static gint input_buffers = 1;
+
+static GOptionEntry entries[] = {
+  {"frames", 'n', 0, G_OPTION_ARG_INT, &frames,
+      "Number of frames to decode", "N"},
+  {"frame-size", 's', 0, G_OPTION_ARG_INT, &frame_size,
+      "Size of each input buffer", "BYTES"},
+  {"width", 0, 0, G_OPTION_ARG_INT, &width, "Frame width", "PIXELS"},
+  {"height", 0, 0, G_OPTION_ARG_INT, &height, "Frame height", "PIXELS"},
+  {"latency", 'l', 0, G_OPTION_ARG_INT, &latency,
+      "Time the codec takes for each frame", "US"},
+  {"threaded", 't', 0, G_OPTION_ARG_NONE, &threaded,
+      "Decode in a separate thread", NULL},
+  {"input-buffers", 'i', 0, G_OPTION_ARG_INT, &input_buffers,
+      "Number of input buffers, in threaded mode", "N"},
+  {NULL}
+};
+
+static volatile gint n_out = 0;
+
+/* input taken by the decoder (only on the streaming thread): */
+static gint n_in = 0;
+static GstClockTime first_in, last_in;
+
+static gboolean
+count_input (GstPad * pad, GstBuffer * buf, gpointer data)
+{
+  last_in = gst_util_get_timestamp ();
+  if (!n_in++) {
+    first_in = last_in;
+  }
+  return TRUE;
+}
+
+static gboolean
+count_output (GstPad * pad, GstBuffer * buf, gpointer data)
+{
+  g_atomic_int_inc (&n_out);
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement *pipeline, *src, *filter, *dec, *sink;
+  GstCaps *caps;
+  GstPad *pad;
+  GstBus *bus;
+  GstMessage *msg;
+  GstClockTime t;
+
+  ctx = g_option_context_new ("- ducati decoder benchmark, with a fake codec");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  fake_dce_latency = latency;
+
+  gst_plugin_register_static (gst_plugin_desc.major_version,
+      gst_plugin_desc.minor_version, "ducatibench", gst_plugin_desc.description,
+      gst_plugin_desc.plugin_init, gst_plugin_desc.version,
+      gst_plugin_desc.license, gst_plugin_desc.source, gst_plugin_desc.package,
+      gst_plugin_desc.origin);
+
+  pipeline = gst_pipeline_new ("bench");
+  src = gst_element_factory_make ("fakesrc", NULL);
+  filter = gst_element_factory_make ("capsfilter", NULL);
+  /* (not by name, in case the real plugin is installed too) */
+  dec = g_object_new (GST_TYPE_DUCATIH264DEC, NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  if (!src || !filter || !sink) {
+    g_printerr ("missing core elements\n");
+    return 1;
+  }
+
+  g_object_set (src, "num-buffers", frames, "sizemax", frame_size, NULL);
+  gst_util_set_object_arg (G_OBJECT (src), "sizetype", "fixed");
+  gst_util_set_object_arg (G_OBJECT (src), "filltype", "zero");
+  caps = gst_caps_new_simple ("video/x-h264",
+      "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+      "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  g_object_set (filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (dec, "threaded", threaded, "input-buffers", input_buffers,
+      NULL);
+  g_object_set (sink, "sync", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, filter, dec, sink, NULL);
+  if (!gst_element_link_many (src, filter, dec, sink, NULL)) {
+    g_printerr ("could not link\n");
+    return 1;
+  }
+
+  pad = gst_element_get_static_pad (dec, "src");
+  gst_pad_add_buffer_probe (pad, G_CALLBACK (count_output), NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (dec, "sink");
+  gst_pad_add_buffer_probe (pad, G_CALLBACK (count_input), NULL);
+  gst_object_unref (pad);
+
+  bus = gst_element_get_bus (pipeline);
+  t = gst_util_get_timestamp ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  t = gst_util_get_timestamp () - t;
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gchar *debug = NULL;
+
+    gst_message_parse_error (msg, &err, &debug);
+    g_printerr ("error: %s (%s)\n", err->message, GST_STR_NULL (debug));
+    return 1;
+  }
+
+  g_print ("%s, %dx%d, %d byte frames, %dus per frame in the codec: "
+      "%d frames in %" GST_TIME_FORMAT ", %.1f fps\n",
+      threaded ? "threaded" : "not threaded", width, height, frame_size,
+      latency, n_out, GST_TIME_ARGS (t), (gdouble) n_out * GST_SECOND / t);
+  if (threaded) {
+    g_print ("%d input buffers: %d frames staged in %" GST_TIME_FORMAT
+        ", %.1f fps\n", input_buffers, n_in,
+        GST_TIME_ARGS (last_in - first_in),
+        (n_in > 1) ? (gdouble) (n_in - 1) * GST_SECOND / (last_in - first_in)
+        : 0.0);
+  }
+
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  return 0;
+}
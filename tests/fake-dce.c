@@ -0,0 +1,218 @@
+/*
+ * GStreamer
+ * Copyright (c) 2010, Texas Instruments Incorporated
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * fake libdce and libmemmgr, to run the decoders without ducati: the codec
+ * takes fake_dce_latency to "decode" each input buffer, and outputs (and
+ * releases) the output buffer it was given right away.  Memory is plain
+ * heap memory, with made up physical addresses in the TILER/raw ranges
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "fake-dce.h"
+
+#define FAKE_PADDR_TILED8  0x60000000
+#define FAKE_PADDR_TILED16 0x68000000
+#define FAKE_PADDR_RAW     0x78000000
+#define FAKE_PADDR_MASK    0x07ffffff
+
+guint fake_dce_latency = 0;
+
+typedef struct
+{
+  gint width, height;
+} FakeCodec;
+
+typedef struct
+{
+  guint8 *ptr;
+  gsize size;
+  gsize y_size;              /* size of the 8bit plane, for 2D, or 0 */
+} FakeAlloc;
+
+static GStaticMutex alloc_lock = G_STATIC_MUTEX_INIT;
+static GList *allocs = NULL;
+
+static gsize
+block_size (MemAllocBlock * block)
+{
+  if (block->pixelFormat == PIXEL_FMT_PAGE) {
+    return block->dim.len;
+  }
+  return block->stride * block->dim.area.height;
+}
+
+void *
+MemMgr_Alloc (MemAllocBlock blocks[], int num_blocks)
+{
+  FakeAlloc *a = g_new0 (FakeAlloc, 1);
+  gint i;
+
+  for (i = 0; i < num_blocks; i++) {
+    a->size += block_size (&blocks[i]);
+  }
+  if (blocks[0].pixelFormat != PIXEL_FMT_PAGE) {
+    a->y_size = block_size (&blocks[0]);
+  }
+  a->ptr = g_malloc (a->size);
+
+  g_static_mutex_lock (&alloc_lock);
+  allocs = g_list_prepend (allocs, a);
+  g_static_mutex_unlock (&alloc_lock);
+
+  return a->ptr;
+}
+
+int
+MemMgr_Free (void *ptr)
+{
+  GList *l;
+
+  g_static_mutex_lock (&alloc_lock);
+  for (l = allocs; l; l = l->next) {
+    FakeAlloc *a = l->data;
+    if (a->ptr == ptr) {
+      allocs = g_list_delete_link (allocs, l);
+      g_free (a->ptr);
+      g_free (a);
+      break;
+    }
+  }
+  g_static_mutex_unlock (&alloc_lock);
+
+  return l ? 0 : -1;
+}
+
+SSPtr
+TilerMem_VirtToPhys (void *ptr)
+{
+  SSPtr paddr = 0;
+  GList *l;
+
+  g_static_mutex_lock (&alloc_lock);
+  for (l = allocs; l; l = l->next) {
+    FakeAlloc *a = l->data;
+    gsize off = (guint8 *) ptr - a->ptr;
+
+    if (((guint8 *) ptr < a->ptr) || (off >= a->size)) {
+      continue;
+    }
+    if (!a->y_size) {
+      paddr = FAKE_PADDR_RAW | (off & FAKE_PADDR_MASK);
+    } else if (off < a->y_size) {
+      paddr = FAKE_PADDR_TILED8 | (off & FAKE_PADDR_MASK);
+    } else {
+      paddr = FAKE_PADDR_TILED16 | ((off - a->y_size) & FAKE_PADDR_MASK);
+    }
+    break;
+  }
+  g_static_mutex_unlock (&alloc_lock);
+
+  return paddr;
+}
+
+void *
+dce_alloc (int sz)
+{
+  return g_malloc0 (sz);
+}
+
+void
+dce_free (void *ptr)
+{
+  g_free (ptr);
+}
+
+Engine_Handle
+Engine_open (String name, Engine_Attrs * attrs, Engine_Error * ec)
+{
+  return (Engine_Handle) g_new0 (gint, 1);
+}
+
+Void
+Engine_close (Engine_Handle engine)
+{
+  g_free (engine);
+}
+
+VIDDEC3_Handle
+VIDDEC3_create (Engine_Handle engine, String name, VIDDEC3_Params * params)
+{
+  FakeCodec *codec = g_new0 (FakeCodec, 1);
+
+  codec->width = params->maxWidth;
+  codec->height = params->maxHeight;
+
+  return (VIDDEC3_Handle) codec;
+}
+
+XDAS_Int32
+VIDDEC3_control (VIDDEC3_Handle codec, VIDDEC3_Cmd id,
+    VIDDEC3_DynamicParams * dynParams, VIDDEC3_Status * status)
+{
+  /* the version would have to be written at a physical address: */
+  if (id == XDM_GETVERSION) {
+    return XDM_EFAIL;
+  }
+  return XDM_EOK;
+}
+
+XDAS_Int32
+VIDDEC3_process (VIDDEC3_Handle handle, XDM2_BufDesc * inBufs,
+    XDM2_BufDesc * outBufs, VIDDEC3_InArgs * inArgs,
+    VIDDEC3_OutArgs * outArgs)
+{
+  FakeCodec *codec = (FakeCodec *) handle;
+  XDM_Rect *r = &outArgs->displayBufs.bufDesc[0].activeFrameRegion;
+
+  outArgs->bytesConsumed = 0;
+  outArgs->outBufsInUseFlag = 0;
+  outArgs->extendedError = 0;
+
+  /* nothing is held on to, so there is nothing to flush out: */
+  if (!inArgs->numBytes) {
+    return XDM_EFAIL;
+  }
+
+  if (fake_dce_latency) {
+    g_usleep (fake_dce_latency);
+  }
+
+  outArgs->bytesConsumed = inArgs->numBytes;
+  outArgs->outputID[0] = inArgs->inputID;
+  outArgs->outputID[1] = 0;
+  outArgs->freeBufID[0] = inArgs->inputID;
+  outArgs->freeBufID[1] = 0;
+
+  r->topLeft.x = 0;
+  r->topLeft.y = 0;
+  r->bottomRight.x = codec->width;
+  r->bottomRight.y = codec->height;
+
+  return XDM_EOK;
+}
+
+Void
+VIDDEC3_delete (VIDDEC3_Handle codec)
+{
+  g_free (codec);
+}
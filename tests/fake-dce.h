@@ -0,0 +1,34 @@
+/*
+ * GStreamer
+ * Copyright (c) 2010, Texas Instruments Incorporated
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __FAKE_DCE_H__
+#define __FAKE_DCE_H__
+
+#include "gstducati.h"
+
+G_BEGIN_DECLS
+
+/* how long (in us) the fake codec's process() blocks, like a call to
+ * ducati would:
+ */
+extern guint fake_dce_latency;
+
+G_END_DECLS
+
+#endif /* __FAKE_DCE_H__ */
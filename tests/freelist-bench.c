@@ -0,0 +1,192 @@
+/*
+ * GStreamer
+ * Copyright (c) 2010, Texas Instruments Incorporated
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * bufferpool freelist contention benchmark: a number of pools (as for that
+ * many decoders), each with one thread getting buffers (like the decoder)
+ * and another one unref'ing them (like the sink), handed over through a
+ * small lock-free ring so that only the freelist is contended.  Compare:
+ *
+ *   ./freelist-bench --pools=4 --iterations=1000000
+ *   ./freelist-bench-locked --pools=4 --iterations=1000000
+ */
+
+/* build the bufferpool in, since the freelist is internal to it: */
+#include "gstducatibufferpool.c"
+
+GST_DEBUG_CATEGORY (gst_ducati_debug);
+
+/* what the bufferpool needs from gstducati.c: */
+
+void *
+gst_ducati_alloc_1d (gint sz)
+{
+  MemAllocBlock block = {
+    .pixelFormat = PIXEL_FMT_PAGE,
+    .dim.len = sz,
+  };
+  return MemMgr_Alloc (&block, 1);
+}
+
+void *
+gst_ducati_alloc_2d (gint width, gint height, guint * sz)
+{
+  g_assert_not_reached ();
+  return NULL;
+}
+
+void
+gst_ducati_shrink_func_add (GstDucatiShrinkFunc func, gpointer data)
+{
+}
+
+void
+gst_ducati_shrink_func_remove (GstDucatiShrinkFunc func, gpointer data)
+{
+}
+
+#define RING_SIZE 16
+
+typedef struct
+{
+  GstDucatiBufferPool *pool;
+  gpointer ring[RING_SIZE];
+} Instance;
+
+static gint n_pools = 4;
+static gint iterations = 1000000;
+static gint size = 4096;
+
+static GOptionEntry entries[] = {
+  {"pools", 'p', 0, G_OPTION_ARG_INT, &n_pools,
+      "Number of pools, each with a getting and a releasing thread", "N"},
+  {"iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+      "Number of buffers to get and release per pool", "N"},
+  {"size", 's', 0, G_OPTION_ARG_INT, &size, "Buffer size in bytes", "BYTES"},
+  {NULL}
+};
+
+static gpointer
+getter_thread (Instance * inst)
+{
+  gint i;
+
+  for (i = 0; i < iterations; i++) {
+    gpointer *slot = &inst->ring[i % RING_SIZE];
+    GstDucatiBuffer *buf = gst_ducati_bufferpool_get (inst->pool, NULL);
+
+    g_assert (buf);
+    while (g_atomic_pointer_get (slot)) {
+      g_thread_yield ();
+    }
+    g_atomic_pointer_set (slot, buf);
+  }
+
+  return NULL;
+}
+
+static gpointer
+releaser_thread (Instance * inst)
+{
+  gint i;
+
+  for (i = 0; i < iterations; i++) {
+    gpointer *slot = &inst->ring[i % RING_SIZE];
+    gpointer buf;
+
+    while (!(buf = g_atomic_pointer_get (slot))) {
+      g_thread_yield ();
+    }
+    g_atomic_pointer_set (slot, NULL);
+    gst_buffer_unref (GST_BUFFER (buf));
+  }
+
+  return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElement *owner;
+  GstCaps *caps;
+  Instance *insts;
+  GThread **threads;
+  GstClockTime t;
+  guint hits = 0, misses = 0;
+  gint i;
+
+  ctx = g_option_context_new ("- bufferpool freelist contention benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  GST_DEBUG_CATEGORY_INIT (gst_ducati_debug, "ducati", 0, "ducati");
+
+  owner = gst_bin_new ("owner");
+  caps = gst_caps_new_simple ("application/octet-stream", NULL);
+  insts = g_new0 (Instance, n_pools);
+  threads = g_new0 (GThread *, 2 * n_pools);
+
+  for (i = 0; i < n_pools; i++) {
+    insts[i].pool = gst_ducati_bufferpool_new_1d (owner, caps, size, 0);
+  }
+
+  t = gst_util_get_timestamp ();
+  for (i = 0; i < n_pools; i++) {
+    threads[2 * i] = g_thread_create ((GThreadFunc) getter_thread,
+        &insts[i], TRUE, NULL);
+    threads[2 * i + 1] = g_thread_create ((GThreadFunc) releaser_thread,
+        &insts[i], TRUE, NULL);
+  }
+  for (i = 0; i < 2 * n_pools; i++) {
+    g_thread_join (threads[i]);
+  }
+  t = gst_util_get_timestamp () - t;
+
+  for (i = 0; i < n_pools; i++) {
+    hits += insts[i].pool->hits;
+    misses += insts[i].pool->misses;
+    gst_ducati_bufferpool_destroy (insts[i].pool);
+  }
+
+#ifdef HAVE_DWCAS
+  g_print ("lock-free freelist, ");
+#else
+  g_print ("locked freelist, ");
+#endif
+  g_print ("%d pools x %d buffers: %" GST_TIME_FORMAT ", %.0f buffers/s, "
+      "%" G_GUINT64_FORMAT "ns per get+unref (%u hits, %u misses)\n",
+      n_pools, iterations, GST_TIME_ARGS (t),
+      (gdouble) n_pools * iterations * GST_SECOND / t,
+      t / iterations, hits, misses);
+
+  gst_ducati_frame_cache_flush ();
+  g_free (threads);
+  g_free (insts);
+  gst_caps_unref (caps);
+  gst_object_unref (owner);
+
+  return 0;
+}